@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(HAVE_LIBSYSTEMD)
+#include <systemd/sd-bus.h>
+#elif defined(HAVE_LIBELOGIND)
+#include <elogind/sd-bus.h>
+#elif defined(HAVE_BASU)
+#include <basu/sd-bus.h>
+#endif
+
+// Sends notifications with image-data hints of several sizes to the running
+// mako, and reports how long it spent in handle_notify() for each of them,
+// as counted by GetStatistics. Skipped if mako isn't running.
+
+#define SKIP 77
+#define ITERATIONS 100
+
+static const char *service_name = "org.freedesktop.Notifications";
+
+static const int image_sizes[] = { 32, 64, 128, 256, 512 };
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int get_stats(sd_bus *bus, uint64_t *calls, uint64_t *ns) {
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	sd_bus_message *reply = NULL;
+	int ret = sd_bus_call_method(bus, service_name, "/fr/emersion/Mako",
+		"fr.emersion.Mako", "GetStatistics", &error, &reply, "");
+	sd_bus_error_free(&error);
+	if (ret < 0) {
+		return ret;
+	}
+
+	*calls = *ns = 0;
+	ret = sd_bus_message_enter_container(reply, 'a', "{sv}");
+	while (ret >= 0 &&
+			(ret = sd_bus_message_enter_container(reply, 'e', "sv")) > 0) {
+		const char *key = NULL;
+		ret = sd_bus_message_read(reply, "s", &key);
+		if (ret < 0) {
+			break;
+		}
+		if (strcmp(key, "notify-calls") == 0) {
+			ret = sd_bus_message_read(reply, "v", "t", calls);
+		} else if (strcmp(key, "notify-time-ns") == 0) {
+			ret = sd_bus_message_read(reply, "v", "t", ns);
+		} else {
+			ret = sd_bus_message_skip(reply, "v");
+		}
+		if (ret >= 0) {
+			ret = sd_bus_message_exit_container(reply);
+		}
+	}
+	sd_bus_message_unref(reply);
+	return ret;
+}
+
+static int notify(sd_bus *bus, uint32_t *id, int size, const uint8_t *pixels) {
+	sd_bus_message *msg = NULL;
+	int ret = sd_bus_message_new_method_call(bus, &msg, service_name,
+		"/org/freedesktop/Notifications", "org.freedesktop.Notifications",
+		"Notify");
+	if (ret < 0) {
+		return ret;
+	}
+
+	// Replace the previous one, so that only one is ever shown
+	ret = sd_bus_message_append(msg, "susssas", "mako-bench", *id, "",
+		"Benchmark", "", 0);
+	if (ret >= 0) {
+		ret = sd_bus_message_open_container(msg, 'a', "{sv}");
+	}
+	if (ret >= 0) {
+		ret = sd_bus_message_open_container(msg, 'e', "sv");
+	}
+	if (ret >= 0) {
+		ret = sd_bus_message_append(msg, "s", "image-data");
+	}
+	if (ret >= 0) {
+		ret = sd_bus_message_open_container(msg, 'v', "(iiibiiay)");
+	}
+	if (ret >= 0) {
+		ret = sd_bus_message_open_container(msg, 'r', "iiibiiay");
+	}
+	if (ret >= 0) {
+		ret = sd_bus_message_append(msg, "iiibii", size, size, 4 * size, 1,
+			8, 4);
+	}
+	if (ret >= 0) {
+		ret = sd_bus_message_append_array(msg, 'y', pixels,
+			(size_t)4 * size * size);
+	}
+	for (int i = 0; i < 4 && ret >= 0; ++i) {
+		ret = sd_bus_message_close_container(msg);
+	}
+	if (ret >= 0) {
+		ret = sd_bus_message_append(msg, "i", -1);
+	}
+
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	sd_bus_message *reply = NULL;
+	if (ret >= 0) {
+		ret = sd_bus_call(bus, msg, 0, &error, &reply);
+	}
+	if (ret >= 0) {
+		ret = sd_bus_message_read(reply, "u", id);
+	}
+	sd_bus_error_free(&error);
+	sd_bus_message_unref(reply);
+	sd_bus_message_unref(msg);
+	return ret;
+}
+
+int main(void) {
+	sd_bus *bus = NULL;
+	if (sd_bus_open_user(&bus) < 0) {
+		fprintf(stderr, "no session bus, skipping\n");
+		return SKIP;
+	}
+
+	uint64_t calls, ns;
+	if (get_stats(bus, &calls, &ns) < 0) {
+		fprintf(stderr, "mako isn't running, skipping\n");
+		sd_bus_unref(bus);
+		return SKIP;
+	}
+
+	int max_size = image_sizes[sizeof(image_sizes) / sizeof(image_sizes[0]) - 1];
+	uint8_t *pixels = malloc((size_t)4 * max_size * max_size);
+	if (pixels == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < (size_t)4 * max_size * max_size; ++i) {
+		pixels[i] = i * 7;
+	}
+
+	printf("%-10s %18s %18s\n", "size", "handle_notify", "round trip");
+	uint32_t id = 0;
+	int ret = 0;
+	for (size_t i = 0; i < sizeof(image_sizes) / sizeof(image_sizes[0]); ++i) {
+		int size = image_sizes[i];
+
+		uint64_t calls_before, ns_before;
+		ret = get_stats(bus, &calls_before, &ns_before);
+		double start = now();
+		for (int j = 0; j < ITERATIONS && ret >= 0; ++j) {
+			ret = notify(bus, &id, size, pixels);
+		}
+		double end = now();
+		if (ret >= 0) {
+			ret = get_stats(bus, &calls, &ns);
+		}
+		if (ret < 0) {
+			fprintf(stderr, "failed to notify: %s\n", strerror(-ret));
+			break;
+		}
+
+		char label[16];
+		snprintf(label, sizeof(label), "%dx%d", size, size);
+		printf("%-10s %15.1f us %15.1f us\n", label,
+			(double)(ns - ns_before) / (calls - calls_before) / 1e3,
+			(end - start) * 1e6 / ITERATIONS);
+	}
+
+	if (id != 0) {
+		sd_bus_call_method(bus, service_name, "/org/freedesktop/Notifications",
+			"org.freedesktop.Notifications", "CloseNotification", NULL, NULL,
+			"u", id);
+	}
+
+	free(pixels);
+	sd_bus_unref(bus);
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
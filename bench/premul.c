@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cairo-pixbuf.h"
+
+// Times the RGBA to premultiplied ARGB32 row converters on common icon sizes,
+// after checking that the vectorized ones match the scalar one exactly.
+
+struct converter {
+	const char *name;
+	convert_row_func func;
+};
+
+static const int icon_sizes[] = { 16, 48, 64, 128, 256 };
+
+static size_t get_converters(struct converter *converters) {
+	size_t len = 0;
+	converters[len++] = (struct converter){ "scalar", convert_rgba_row_scalar };
+#if defined(__SSE2__)
+	converters[len++] = (struct converter){ "sse2", convert_rgba_row_sse2 };
+#endif
+#if defined(HAVE_AVX2_DISPATCH)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		converters[len++] = (struct converter){ "avx2", convert_rgba_row_avx2 };
+	}
+#endif
+	return len;
+}
+
+static void fill_random(guint8 *data, size_t size) {
+	uint32_t state = 0x12345678;
+	for (size_t i = 0; i < size; ++i) {
+		state = state * 1103515245 + 12345;
+		data[i] = state >> 24;
+	}
+}
+
+// Every (color, alpha) pair, in each channel, then rows of every width up to
+// a few vectors to cover the scalar tails.
+static bool check_converter(const struct converter *conv) {
+	const int width = 256 * 256;
+	guint8 *src = malloc(4 * width);
+	unsigned char *want = malloc(4 * width);
+	unsigned char *got = malloc(4 * width);
+	if (src == NULL || want == NULL || got == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < width; ++i) {
+		guint8 color = i & 0xFF;
+		src[4*i + 0] = color;
+		src[4*i + 1] = 0xFF - color;
+		src[4*i + 2] = color ^ 0x55;
+		src[4*i + 3] = i >> 8;
+	}
+	convert_rgba_row_scalar(want, src, width);
+	conv->func(got, src, width);
+	bool ok = memcmp(want, got, 4 * width) == 0;
+
+	fill_random(src, 4 * 64);
+	for (int w = 1; ok && w <= 64; ++w) {
+		memset(want, 0, 4 * w);
+		memset(got, 0, 4 * w);
+		convert_rgba_row_scalar(want, src, w);
+		conv->func(got, src, w);
+		ok = memcmp(want, got, 4 * w) == 0;
+	}
+
+	free(src);
+	free(want);
+	free(got);
+	return ok;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the time to convert one size x size icon, in nanoseconds.
+static double time_converter(const struct converter *conv, int size,
+		const guint8 *src, unsigned char *dst) {
+	// Roughly the same amount of work for every size
+	int iterations = 50000000 / (size * size);
+	if (iterations < 10) {
+		iterations = 10;
+	}
+
+	double start = now();
+	for (int i = 0; i < iterations; ++i) {
+		const guint8 *s = src;
+		unsigned char *d = dst;
+		for (int y = 0; y < size; ++y) {
+			conv->func(d, s, size);
+			s += 4 * size;
+			d += 4 * size;
+		}
+		// Don't let the compiler skip the conversions
+		__asm__ volatile("" : : "r"(dst) : "memory");
+	}
+	return (now() - start) * 1e9 / iterations;
+}
+
+int main(void) {
+	struct converter converters[3];
+	size_t converters_len = get_converters(converters);
+
+	bool ok = true;
+	for (size_t i = 1; i < converters_len; ++i) {
+		if (!check_converter(&converters[i])) {
+			fprintf(stderr, "%s doesn't match the scalar conversion\n",
+				converters[i].name);
+			ok = false;
+		}
+	}
+	if (!ok) {
+		return EXIT_FAILURE;
+	}
+
+	int max_size = icon_sizes[sizeof(icon_sizes) / sizeof(icon_sizes[0]) - 1];
+	guint8 *src = malloc(4 * max_size * max_size);
+	unsigned char *dst = malloc(4 * max_size * max_size);
+	if (src == NULL || dst == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return EXIT_FAILURE;
+	}
+	fill_random(src, 4 * max_size * max_size);
+
+	printf("%-8s", "size");
+	for (size_t i = 0; i < converters_len; ++i) {
+		printf("%14s", converters[i].name);
+	}
+	printf("   (ns per icon)\n");
+	for (size_t i = 0; i < sizeof(icon_sizes) / sizeof(icon_sizes[0]); ++i) {
+		int size = icon_sizes[i];
+		char label[16];
+		snprintf(label, sizeof(label), "%dx%d", size, size);
+		printf("%-8s", label);
+		for (size_t j = 0; j < converters_len; ++j) {
+			printf("%14.0f", time_converter(&converters[j], size, src, dst));
+		}
+		printf("\n");
+	}
+
+	free(src);
+	free(dst);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event-loop.h"
+
+// Adds and cancels lots of timers, as a burst of expiring notifications
+// would. The timers never fire, only their bookkeeping is measured.
+
+#define TIMERS_LEN 100000
+
+static void handle_timer(void *data) {
+	// Unreachable, the event loop isn't run
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t next_random(uint32_t *state) {
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+static void shuffle(struct mako_timer **timers, size_t len, uint32_t *state) {
+	for (size_t i = len - 1; i > 0; --i) {
+		size_t j = next_random(state) % (i + 1);
+		struct mako_timer *tmp = timers[i];
+		timers[i] = timers[j];
+		timers[j] = tmp;
+	}
+}
+
+// Delays are at least an hour, so that nothing expires during the benchmark.
+static void run(struct mako_event_loop *loop, struct mako_timer **timers,
+		const char *name, bool random_delays, bool random_order) {
+	uint32_t state = 42;
+
+	double start = now();
+	for (size_t i = 0; i < TIMERS_LEN; ++i) {
+		int delay = 3600000;
+		if (random_delays) {
+			delay += next_random(&state) % 3600000;
+		}
+		timers[i] = add_event_loop_timer(loop, delay, 0, handle_timer, NULL);
+		if (timers[i] == NULL) {
+			fprintf(stderr, "failed to add a timer\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	double added = now();
+
+	if (random_order) {
+		shuffle(timers, TIMERS_LEN, &state);
+	}
+	for (size_t i = 0; i < TIMERS_LEN; ++i) {
+		destroy_timer(timers[i]);
+	}
+	double cancelled = now();
+
+	printf("%-32s add %7.1f ms (%5.0f ns/op)  cancel %7.1f ms (%5.0f ns/op)\n",
+		name, (added - start) * 1e3, (added - start) * 1e9 / TIMERS_LEN,
+		(cancelled - added) * 1e3,
+		(cancelled - added) * 1e9 / TIMERS_LEN);
+}
+
+int main(void) {
+	// The event loop wants a bus and a display, neither is used here
+	int bus_fds[2], display_fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, bus_fds) != 0 ||
+			socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0,
+				display_fds) != 0) {
+		perror("socketpair");
+		return EXIT_FAILURE;
+	}
+
+	sd_bus *bus = NULL;
+	if (sd_bus_new(&bus) < 0 || sd_bus_set_fd(bus, bus_fds[0], bus_fds[0]) < 0) {
+		fprintf(stderr, "failed to create the bus\n");
+		return EXIT_FAILURE;
+	}
+	struct wl_display *display = wl_display_connect_to_fd(display_fds[0]);
+	if (display == NULL) {
+		fprintf(stderr, "failed to create the display\n");
+		return EXIT_FAILURE;
+	}
+
+	struct mako_event_loop loop;
+	if (!init_event_loop(&loop, bus, display)) {
+		return EXIT_FAILURE;
+	}
+
+	struct mako_timer **timers = calloc(TIMERS_LEN, sizeof(*timers));
+	if (timers == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%d timers\n", TIMERS_LEN);
+	run(&loop, timers, "same delay, cancel in order", false, false);
+	run(&loop, timers, "same delay, cancel shuffled", false, true);
+	run(&loop, timers, "random delays, cancel in order", true, false);
+	run(&loop, timers, "random delays, cancel shuffled", true, true);
+
+	free(timers);
+	finish_event_loop(&loop);
+	wl_display_disconnect(display);
+	sd_bus_unref(bus);
+	close(bus_fds[1]);
+	close(display_fds[1]);
+	return EXIT_SUCCESS;
+}
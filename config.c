@@ -17,6 +17,7 @@ static int32_t max(int32_t a, int32_t b) {
 
 void init_default_config(struct mako_config *config) {
 	wl_list_init(&config->criteria);
+	config->criteria_index = NULL;
 	struct mako_criteria *new_criteria = create_criteria(config);
 	init_default_style(&new_criteria->style);
 	new_criteria->raw_string = strdup("(root)");
@@ -54,6 +55,12 @@ void init_default_config(struct mako_config *config) {
 	init_empty_style(&config->superstyle);
 
 	config->max_history = 5;
+	config->icon_cache_size = 16 * 1024 * 1024;
+	config->timer_slack = 0;
+	config->persistent_history = false;
+	config->max_persistent_history = 10000;
+	config->max_exec = 0;
+	config->exec_helper = false;
 	config->sort_criteria = MAKO_SORT_CRITERIA_TIME;
 	config->sort_asc = 0;
 }
@@ -63,6 +70,8 @@ void finish_config(struct mako_config *config) {
 	wl_list_for_each_safe(criteria, tmp, &config->criteria, link) {
 		destroy_criteria(criteria);
 	}
+	destroy_criteria_index(config->criteria_index);
+	config->criteria_index = NULL;
 
 	finish_style(&config->superstyle);
 }
@@ -110,6 +119,7 @@ void init_default_style(struct mako_style *style) {
 	style->actions = true;
 	style->default_timeout = 0;
 	style->ignore_timeout = false;
+	style->exec_timeout = 0;
 
 	style->colors.background = 0x285577FF;
 	style->colors.text = 0xFFFFFFFF;
@@ -311,6 +321,11 @@ bool apply_style(struct mako_style *target, const struct mako_style *style) {
 		target->spec.ignore_timeout = true;
 	}
 
+	if (style->spec.exec_timeout) {
+		target->exec_timeout = style->exec_timeout;
+		target->spec.exec_timeout = true;
+	}
+
 	if (style->spec.colors.background) {
 		target->colors.background = style->colors.background;
 		target->spec.colors.background = true;
@@ -542,6 +557,20 @@ static bool apply_config_option(struct mako_config *config, const char *name,
 		return true;
 	} else if (strcmp(name, "max-history") == 0) {
 		return parse_int(value, &config->max_history);
+	} else if (strcmp(name, "icon-cache-size") == 0) {
+		return parse_size(value, &config->icon_cache_size);
+	} else if (strcmp(name, "timer-slack") == 0) {
+		return parse_int(value, &config->timer_slack) &&
+			config->timer_slack >= 0;
+	} else if (strcmp(name, "persistent-history") == 0) {
+		return parse_boolean(value, &config->persistent_history);
+	} else if (strcmp(name, "max-persistent-history") == 0) {
+		return parse_int(value, &config->max_persistent_history) &&
+			config->max_persistent_history >= 0;
+	} else if (strcmp(name, "max-exec") == 0) {
+		return parse_int(value, &config->max_exec) && config->max_exec >= 0;
+	} else if (strcmp(name, "exec-helper") == 0) {
+		return parse_boolean(value, &config->exec_helper);
 	} else if (strcmp(name, "include") == 0) {
 		char *path = expand_config_path(value);
 		return path && load_config_file(config, path) == 0;
@@ -642,6 +671,9 @@ static bool apply_style_option(struct mako_style *style, const char *name,
 	} else if (strcmp(name, "ignore-timeout") == 0) {
 		return spec->ignore_timeout =
 			parse_boolean(value, &style->ignore_timeout);
+	} else if (strcmp(name, "exec-timeout") == 0) {
+		return spec->exec_timeout =
+			parse_int_ge(value, &style->exec_timeout, 0);
 	} else if (strcmp(name, "group-by") == 0) {
 		return spec->group_criteria_spec =
 			parse_criteria_spec(value, &style->group_criteria_spec);
@@ -918,6 +950,13 @@ int parse_config_arguments(struct mako_config *config, int argc, char **argv) {
 		{"format", required_argument, 0, 0},
 		{"max-visible", required_argument, 0, 0},
 		{"max-history", required_argument, 0, 0},
+		{"icon-cache-size", required_argument, 0, 0},
+		{"timer-slack", required_argument, 0, 0},
+		{"persistent-history", required_argument, 0, 0},
+		{"max-persistent-history", required_argument, 0, 0},
+		{"max-exec", required_argument, 0, 0},
+		{"exec-timeout", required_argument, 0, 0},
+		{"exec-helper", required_argument, 0, 0},
 		{"history", required_argument, 0, 0},
 		{"default-timeout", required_argument, 0, 0},
 		{"ignore-timeout", required_argument, 0, 0},
@@ -1007,6 +1046,13 @@ int reload_config(struct mako_config *config, int argc, char **argv) {
 
 	apply_superset_style(&new_config.superstyle, &new_config);
 
+	if (!compile_criteria(&new_config)) {
+		finish_config(&new_config);
+		return -1;
+	}
+
+	new_config.serial = config->serial + 1;
+
 	finish_config(config);
 	*config = new_config;
 
@@ -29,10 +29,17 @@ complete -c mako -l format -d 'Format string' -x
 complete -c mako -l hidden-format -d 'Hidden format string' -x
 complete -c mako -l max-visible -d 'Max visible notifications' -x
 complete -c mako -l max-history -d 'Max size of history buffer' -x
+complete -c mako -l icon-cache-size -d 'Memory used to cache decoded icons' -x
+complete -c mako -l timer-slack -d 'Round expiration times in ms' -x
+complete -c mako -l persistent-history -d 'Also keep history on disk' -xa "1 0"
+complete -c mako -l max-persistent-history -d 'Max size of on-disk history' -x
+complete -c mako -l max-exec -d 'Max number of exec bindings running at once' -x
+complete -c mako -l exec-helper -d 'Run exec bindings from a helper process' -xa "1 0"
 complete -c mako -l history -d 'Add expired notifications to history' -xa "1 0"
 complete -c mako -l sort -d 'Set notification sorting method' -x
 complete -c mako -l default-timeout -d 'Notification timeout in ms' -x
 complete -c mako -l ignore-timeout -d 'Enable notification timeout or not' -xa "1 0"
+complete -c mako -l exec-timeout -d 'Terminate exec bindings after this many ms' -x
 complete -c mako -l output -d 'Show notifications on this output' -xa '(complete_outputs)'
 complete -c mako -l layer -d 'Show notifications on this layer' -x
 complete -c mako -l anchor -d 'Position on output to put notifications' -x
@@ -1,6 +1,6 @@
 function __fish_makoctl_complete_no_subcommand
 	for i in (commandline -opc)
-		if contains -- $i dismiss restore invoke menu list reload mode help
+		if contains -- $i dismiss restore invoke menu list history watch reload mode help
 			return 1
 		end
 	end
@@ -13,6 +13,7 @@ complete -c makoctl -n '__fish_makoctl_complete_no_subcommand' -a invoke -d 'Inv
 complete -c makoctl -n '__fish_makoctl_complete_no_subcommand' -a menu -d 'Use a program to select one action to be invoked on the notification (the last one if none is given)' -x
 complete -c makoctl -n '__fish_makoctl_complete_no_subcommand' -a list -d 'List notifications' -x
 complete -c makoctl -n '__fish_makoctl_complete_no_subcommand' -a history -d 'List history' -x
+complete -c makoctl -n '__fish_makoctl_complete_no_subcommand' -a watch -d 'Print notification and mode changes as they happen' -x
 complete -c makoctl -n '__fish_makoctl_complete_no_subcommand' -a reload -d 'Reload the configuration file' -x
 complete -c makoctl -n '__fish_makoctl_complete_no_subcommand' -a mode -d 'List, activate, or deactivate modes' -x
 complete -c makoctl -n '__fish_makoctl_complete_no_subcommand' -a help -d 'Show help message and quit' -x
@@ -24,6 +25,13 @@ complete -c makoctl -n '__fish_seen_subcommand_from dismiss' -s n -d "Dismiss th
 complete -c makoctl -n '__fish_seen_subcommand_from invoke' -s n -d "Invoke an action on the notification with the given id" -x
 complete -c makoctl -n '__fish_seen_subcommand_from menu' -s n -d "Use a program to select one action on the notification with the given id" -x
 complete -c makoctl -n '__fish_seen_subcommand_from menu' -a "(__fish_complete_command)" -x
+complete -c makoctl -n '__fish_seen_subcommand_from list history' -s j -d "Use JSON output"
+complete -c makoctl -n '__fish_seen_subcommand_from list history' -s f -l filter -d "Only list notifications matching the criteria" -x
+complete -c makoctl -n '__fish_seen_subcommand_from list history' -s l -l limit -d "List at most this many notifications" -x
+complete -c makoctl -n '__fish_seen_subcommand_from list history' -s F -l fields -d "Only retrieve the given comma-separated fields" -x
+complete -c makoctl -n '__fish_seen_subcommand_from history' -s p -l persistent -d "Read the persistent history"
+complete -c makoctl -n '__fish_seen_subcommand_from watch' -s j -l json -d "Print one JSON object per event"
+complete -c makoctl -n '__fish_seen_subcommand_from watch' -s f -l filter -d "Only report notifications matching the criteria" -x
 complete -c makoctl -n '__fish_seen_subcommand_from mode' -s a -d "Add mode" -x
 complete -c makoctl -n '__fish_seen_subcommand_from mode' -s r -d "Remove mode" -x
 complete -c makoctl -n '__fish_seen_subcommand_from mode' -s t -d "Toggle mode" -x
@@ -10,6 +10,7 @@
 #include "mako.h"
 #include "config.h"
 #include "criteria.h"
+#include "hash-table.h"
 #include "mode.h"
 #include "notification.h"
 #include "surface.h"
@@ -418,23 +419,237 @@ struct mako_criteria *global_criteria(struct mako_config *config) {
 	return criteria;
 }
 
-// Iterate through `criteria_list`, applying the style from each matching
-// criteria to `notif`. Returns the number of criteria that matched, or -1 if
-// a failure occurs.
-ssize_t apply_each_criteria(struct wl_list *criteria_list,
-		struct mako_notification *notif) {
-	ssize_t match_count = 0;
+// Criteria are bucketed on the most selective exact-match field they specify,
+// so that only a handful of them have to be checked against any given
+// notification. Criteria that don't specify any of these fields end up in the
+// wildcard list and are always checked. Each list holds `struct mako_criteria *`
+// in configuration order.
+struct mako_criteria_index {
+	struct mako_hash_table app_name; // value is a struct wl_array *
+	struct mako_hash_table desktop_entry;
+	struct mako_hash_table category;
+	struct wl_array urgency[MAKO_NOTIFICATION_URGENCY_CRITICAL + 1];
+	struct wl_array wildcard;
+};
+
+static bool append_criteria(struct wl_array *list,
+		struct mako_criteria *criteria) {
+	struct mako_criteria **entry = wl_array_add(list, sizeof(*entry));
+	if (entry == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
+	*entry = criteria;
+	return true;
+}
+
+static bool add_to_bucket(struct mako_hash_table *table, const char *key,
+		struct mako_criteria *criteria) {
+	struct wl_array *list = hash_table_get(table, key, strlen(key));
+	if (list == NULL) {
+		list = calloc(1, sizeof(struct wl_array));
+		if (list == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			return false;
+		}
+		wl_array_init(list);
+
+		if (!hash_table_set(table, key, strlen(key), list)) {
+			free(list);
+			return false;
+		}
+	}
+
+	return append_criteria(list, criteria);
+}
+
+static void finish_buckets(struct mako_hash_table *table) {
+	size_t iter = 0;
+	struct mako_hash_entry *entry;
+	while ((entry = hash_table_next(table, &iter)) != NULL) {
+		struct wl_array *list = entry->value;
+		wl_array_release(list);
+		free(list);
+	}
+	hash_table_finish(table);
+}
+
+void destroy_criteria_index(struct mako_criteria_index *index) {
+	if (index == NULL) {
+		return;
+	}
+
+	finish_buckets(&index->app_name);
+	finish_buckets(&index->desktop_entry);
+	finish_buckets(&index->category);
+	for (size_t i = 0; i < sizeof(index->urgency) / sizeof(index->urgency[0]); ++i) {
+		wl_array_release(&index->urgency[i]);
+	}
+	wl_array_release(&index->wildcard);
+	free(index);
+}
+
+static bool index_criteria(struct mako_criteria_index *index,
+		struct mako_criteria *criteria) {
+	struct mako_criteria_spec *spec = &criteria->spec;
+
+	if (spec->app_name) {
+		return add_to_bucket(&index->app_name, criteria->app_name, criteria);
+	} else if (spec->desktop_entry) {
+		return add_to_bucket(&index->desktop_entry, criteria->desktop_entry,
+			criteria);
+	} else if (spec->category) {
+		return add_to_bucket(&index->category, criteria->category, criteria);
+	} else if (spec->urgency && criteria->urgency >= 0 &&
+			criteria->urgency <= MAKO_NOTIFICATION_URGENCY_CRITICAL) {
+		return append_criteria(&index->urgency[criteria->urgency], criteria);
+	}
+
+	return append_criteria(&index->wildcard, criteria);
+}
+
+// Build the lookup structure used by apply_each_criteria. Must be called
+// whenever the criteria list of the configuration changes.
+bool compile_criteria(struct mako_config *config) {
+	struct mako_criteria_index *index =
+		calloc(1, sizeof(struct mako_criteria_index));
+	if (index == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
 
+	hash_table_init(&index->app_name);
+	hash_table_init(&index->desktop_entry);
+	hash_table_init(&index->category);
+	for (size_t i = 0; i < sizeof(index->urgency) / sizeof(index->urgency[0]); ++i) {
+		wl_array_init(&index->urgency[i]);
+	}
+	wl_array_init(&index->wildcard);
+
+	size_t position = 0;
 	struct mako_criteria *criteria;
-	wl_list_for_each(criteria, criteria_list, link) {
-		if (!match_criteria(criteria, notif)) {
+	wl_list_for_each(criteria, &config->criteria, link) {
+		criteria->position = position++;
+
+		if (criteria->spec.none) {
+			// Can never match, no need to look at it again.
 			continue;
 		}
-		++match_count;
 
-		if (!apply_style(&notif->style, &criteria->style)) {
+		if (!index_criteria(index, criteria)) {
+			destroy_criteria_index(index);
+			return false;
+		}
+	}
+
+	destroy_criteria_index(config->criteria_index);
+	config->criteria_index = index;
+	return true;
+}
+
+static struct wl_array *lookup_bucket(struct mako_hash_table *table,
+		const char *key) {
+	if (key == NULL) {
+		return NULL;
+	}
+	return hash_table_get(table, key, strlen(key));
+}
+
+// Returns 1 if the criteria matched and its style was applied, 0 if it didn't
+// match, or -1 on failure.
+static int apply_criteria(struct mako_criteria *criteria,
+		struct mako_notification *notif) {
+	if (!match_criteria(criteria, notif)) {
+		return 0;
+	}
+	if (!apply_style(&notif->style, &criteria->style)) {
+		return -1;
+	}
+	return 1;
+}
+
+static ssize_t apply_indexed_criteria(struct mako_criteria_index *index,
+		struct mako_notification *notif) {
+	// Every criteria lives in exactly one of these lists, and each list is in
+	// configuration order, so merging them yields the matching criteria in the
+	// same order as walking the whole configuration would.
+	struct wl_array *lists[5];
+	size_t lists_len = 0;
+
+	lists[lists_len++] = &index->wildcard;
+	if (notif->urgency >= 0 &&
+			notif->urgency <= MAKO_NOTIFICATION_URGENCY_CRITICAL) {
+		lists[lists_len++] = &index->urgency[notif->urgency];
+	}
+
+	struct wl_array *list;
+	if ((list = lookup_bucket(&index->app_name, notif->app_name))) {
+		lists[lists_len++] = list;
+	}
+	if ((list = lookup_bucket(&index->desktop_entry, notif->desktop_entry))) {
+		lists[lists_len++] = list;
+	}
+	if ((list = lookup_bucket(&index->category, notif->category))) {
+		lists[lists_len++] = list;
+	}
+
+	size_t heads[5] = {0};
+	ssize_t match_count = 0;
+	while (true) {
+		struct mako_criteria *next = NULL;
+		size_t next_list = 0;
+		for (size_t i = 0; i < lists_len; ++i) {
+			size_t len = lists[i]->size / sizeof(struct mako_criteria *);
+			if (heads[i] == len) {
+				continue;
+			}
+
+			struct mako_criteria **data = lists[i]->data;
+			struct mako_criteria *criteria = data[heads[i]];
+			if (next == NULL || criteria->position < next->position) {
+				next = criteria;
+				next_list = i;
+			}
+		}
+
+		if (next == NULL) {
+			break;
+		}
+		++heads[next_list];
+
+		int ret = apply_criteria(next, notif);
+		if (ret < 0) {
 			return -1;
 		}
+		match_count += ret;
+	}
+
+	return match_count;
+}
+
+// Apply the style from each criteria in `config` matching `notif`, in
+// configuration order. Returns the number of criteria that matched, or -1 if
+// a failure occurs.
+ssize_t apply_each_criteria(struct mako_config *config,
+		struct mako_notification *notif) {
+	ssize_t match_count = 0;
+
+	if (config->criteria_index != NULL) {
+		match_count = apply_indexed_criteria(config->criteria_index, notif);
+	} else {
+		struct mako_criteria *criteria;
+		wl_list_for_each(criteria, &config->criteria, link) {
+			int ret = apply_criteria(criteria, notif);
+			if (ret < 0) {
+				match_count = -1;
+				break;
+			}
+			match_count += ret;
+		}
+	}
+
+	if (match_count < 0) {
+		return -1;
 	}
 
 	struct mako_surface *surface;
@@ -455,6 +670,50 @@ ssize_t apply_each_criteria(struct wl_list *criteria_list,
 	return match_count;
 }
 
+static bool style_key_equal(const struct mako_style_key *a,
+		const struct mako_style_key *b) {
+	return a->config_serial == b->config_serial &&
+		a->modes_serial == b->modes_serial &&
+		a->outputs_serial == b->outputs_serial &&
+		a->surface == b->surface &&
+		a->group_index == b->group_index &&
+		a->hidden == b->hidden;
+}
+
+// Make sure the style of `notif` is up to date, only re-matching criteria if
+// the notification was reset or one of the inputs in mako_style_key changed
+// since the last call. Returns the number of criteria that matched, or -1 if
+// a failure occurs.
+ssize_t resolve_notification_style(struct mako_notification *notif) {
+	struct mako_state *state = notif->state;
+
+	// Captured before matching, as matching can assign a surface, and
+	// criteria on the surface must then be evaluated again.
+	struct mako_style_key key = {
+		.config_serial = state->config.serial,
+		.modes_serial = state->modes_serial,
+		.outputs_serial = state->outputs_serial,
+		.surface = notif->surface,
+		.group_index = notif->group_index,
+		.hidden = notif->hidden,
+	};
+
+	if (notif->style_valid && style_key_equal(&key, &notif->style_key)) {
+		++state->stats.style_hits;
+		return notif->style_match_count;
+	}
+	++state->stats.style_misses;
+
+	finish_style(&notif->style);
+	init_empty_style(&notif->style);
+
+	ssize_t match_count = apply_each_criteria(&state->config, notif);
+	notif->style_valid = match_count > 0;
+	notif->style_key = key;
+	notif->style_match_count = match_count;
+	return match_count;
+}
+
 // Given a notification and a criteria spec, create a criteria that matches the
 // specified fields of that notification. Unlike create_criteria, this new
 // criteria will not be automatically inserted into the configuration. It is
@@ -6,6 +6,7 @@
 #include "criteria.h"
 #include "surface.h"
 #include "dbus.h"
+#include "icon.h"
 #include "mako.h"
 #include "mode.h"
 #include "notification.h"
@@ -14,6 +15,20 @@
 static const char *service_path = "/fr/emersion/Mako";
 static const char *service_interface = "fr.emersion.Mako";
 
+// Returns the notification with the given id, or the first one if id is 0.
+static struct mako_notification *find_notification(struct mako_state *state,
+		uint32_t id) {
+	if (id != 0) {
+		return get_notification(state, id);
+	}
+	if (wl_list_empty(&state->notifications)) {
+		return NULL;
+	}
+	struct mako_notification *notif =
+		wl_container_of(state->notifications.next, notif, link);
+	return notif;
+}
+
 static int handle_dismiss(sd_bus_message *msg, void *data,
 		sd_bus_error *ret_error) {
 	struct mako_state *state = data;
@@ -70,19 +85,17 @@ static int handle_dismiss(sd_bus_message *msg, void *data,
 		return -EINVAL;
 	}
 
-	struct mako_notification *notif;
-	wl_list_for_each(notif, &state->notifications, link) {
-		if (notif->id == id || id == 0) {
+	struct mako_notification *notif = find_notification(state, id);
+	if (notif != NULL) {
+		// The bulk paths mark the affected surfaces dirty themselves
+		if (group) {
+			close_group_notifications(notif, MAKO_NOTIFICATION_CLOSE_DISMISSED, history);
+		} else if (all) {
+			close_all_notifications(state, MAKO_NOTIFICATION_CLOSE_DISMISSED, history);
+		} else {
 			struct mako_surface *surface = notif->surface;
-			if (group) {
-				close_group_notifications(notif, MAKO_NOTIFICATION_CLOSE_DISMISSED, history);
-			} else if (all) {
-				close_all_notifications(state, MAKO_NOTIFICATION_CLOSE_DISMISSED, history);
-			} else {
-				close_notification(notif, MAKO_NOTIFICATION_CLOSE_DISMISSED, history);
-			}
+			close_notification(notif, MAKO_NOTIFICATION_CLOSE_DISMISSED, history);
 			set_dirty(surface);
-			break;
 		}
 	}
 
@@ -100,17 +113,14 @@ static int handle_invoke_action(sd_bus_message *msg, void *data,
 		return ret;
 	}
 
-	struct mako_notification *notif;
-	wl_list_for_each(notif, &state->notifications, link) {
-		if (notif->id == id || id == 0) {
-			struct mako_action *action;
-			wl_list_for_each(action, &notif->actions, link) {
-				if (strcmp(action->key, action_key) == 0) {
-					notify_action_invoked(action, NULL);
-					break;
-				}
+	struct mako_notification *notif = find_notification(state, id);
+	if (notif != NULL) {
+		struct mako_action *action;
+		wl_list_for_each(action, &notif->actions, link) {
+			if (strcmp(action->key, action_key) == 0) {
+				notify_action_invoked(action, NULL);
+				break;
 			}
-			break;
 		}
 	}
 
@@ -121,175 +131,581 @@ static int handle_restore_action(sd_bus_message *msg, void *data,
 		sd_bus_error *ret_error) {
 	struct mako_state *state = data;
 
-	if (wl_list_empty(&state->history)) {
+	struct mako_notification *notif = restore_history(state);
+	if (notif == NULL) {
 		goto done;
 	}
 
-	struct mako_notification *notif =
-		wl_container_of(state->history.next, notif, link);
-	wl_list_remove(&notif->link);
-
-	finish_style(&notif->style);
-	init_empty_style(&notif->style);
-	apply_each_criteria(&state->config.criteria, notif);
-
 	insert_notification(state, notif);
+	if (resolve_notification_style(notif) <= 0) {
+		fprintf(stderr, "Failed to apply criteria\n");
+		destroy_notification(notif);
+		goto done;
+	}
+	if (notif->style.icons) {
+		notif->icon = create_icon(notif);
+	}
+	group_notification(notif);
+	emit_notification_added(notif);
 	set_dirty(notif->surface);
 
 done:
 	return sd_bus_reply_method_return(msg, "");
 }
 
-static int handle_list_for_each(sd_bus_message *reply, struct wl_list *list) {
+// Fields of the a{sv} notification dictionaries, which callers of the
+// Query* methods can pick from
+enum mako_notification_field {
+	MAKO_NOTIFICATION_FIELD_ID = 1 << 0,
+	MAKO_NOTIFICATION_FIELD_APP_NAME = 1 << 1,
+	MAKO_NOTIFICATION_FIELD_APP_ICON = 1 << 2,
+	MAKO_NOTIFICATION_FIELD_CATEGORY = 1 << 3,
+	MAKO_NOTIFICATION_FIELD_DESKTOP_ENTRY = 1 << 4,
+	MAKO_NOTIFICATION_FIELD_SUMMARY = 1 << 5,
+	MAKO_NOTIFICATION_FIELD_BODY = 1 << 6,
+	MAKO_NOTIFICATION_FIELD_URGENCY = 1 << 7,
+	MAKO_NOTIFICATION_FIELD_ACTIONS = 1 << 8,
+	MAKO_NOTIFICATION_FIELD_ALL = (1 << 9) - 1,
+};
 
-	int ret = sd_bus_message_open_container(reply, 'a', "a{sv}");
+static const struct {
+	const char *name;
+	enum mako_notification_field field;
+} notification_fields[] = {
+	{ "id", MAKO_NOTIFICATION_FIELD_ID },
+	{ "app-name", MAKO_NOTIFICATION_FIELD_APP_NAME },
+	{ "app-icon", MAKO_NOTIFICATION_FIELD_APP_ICON },
+	{ "category", MAKO_NOTIFICATION_FIELD_CATEGORY },
+	{ "desktop-entry", MAKO_NOTIFICATION_FIELD_DESKTOP_ENTRY },
+	{ "summary", MAKO_NOTIFICATION_FIELD_SUMMARY },
+	{ "body", MAKO_NOTIFICATION_FIELD_BODY },
+	{ "urgency", MAKO_NOTIFICATION_FIELD_URGENCY },
+	{ "actions", MAKO_NOTIFICATION_FIELD_ACTIONS },
+};
+
+static int append_string_field(sd_bus_message *reply, uint32_t fields,
+		enum mako_notification_field field, const char *key,
+		const char *value) {
+	if (!(fields & field)) {
+		return 0;
+	}
+	return sd_bus_message_append(reply, "{sv}", key, "s", value);
+}
+
+static int append_notification_fields(sd_bus_message *reply, uint32_t fields,
+		uint32_t id, const char *app_name, const char *app_icon,
+		const char *category, const char *desktop_entry, const char *summary,
+		const char *body, enum mako_notification_urgency urgency) {
+	int ret = append_string_field(reply, fields,
+		MAKO_NOTIFICATION_FIELD_APP_NAME, "app-name", app_name);
 	if (ret < 0) {
 		return ret;
 	}
 
-	struct mako_notification *notif;
-	wl_list_for_each(notif, list, link) {
-		int ret = sd_bus_message_open_container(reply, 'a', "{sv}");
-		if (ret < 0) {
-			return ret;
-		}
+	ret = append_string_field(reply, fields,
+		MAKO_NOTIFICATION_FIELD_APP_ICON, "app-icon", app_icon);
+	if (ret < 0) {
+		return ret;
+	}
 
-		ret = sd_bus_message_append(reply, "{sv}", "app-name",
-			"s", notif->app_name);
-		if (ret < 0) {
-			return ret;
-		}
+	ret = append_string_field(reply, fields,
+		MAKO_NOTIFICATION_FIELD_CATEGORY, "category", category);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = append_string_field(reply, fields,
+		MAKO_NOTIFICATION_FIELD_DESKTOP_ENTRY, "desktop-entry", desktop_entry);
+	if (ret < 0) {
+		return ret;
+	}
 
-		ret = sd_bus_message_append(reply, "{sv}", "app-icon",
-			"s", notif->app_icon);
+	ret = append_string_field(reply, fields,
+		MAKO_NOTIFICATION_FIELD_SUMMARY, "summary", summary);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = append_string_field(reply, fields,
+		MAKO_NOTIFICATION_FIELD_BODY, "body", body);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (fields & MAKO_NOTIFICATION_FIELD_ID) {
+		ret = sd_bus_message_append(reply, "{sv}", "id", "u", id);
 		if (ret < 0) {
 			return ret;
 		}
+	}
 
-		ret = sd_bus_message_append(reply, "{sv}", "category",
-			"s", notif->category);
+	if (fields & MAKO_NOTIFICATION_FIELD_URGENCY) {
+		ret = sd_bus_message_append(reply, "{sv}", "urgency", "y", urgency);
 		if (ret < 0) {
 			return ret;
 		}
+	}
+
+	return 0;
+}
+
+// Opens the "actions" dict entry, which must then be filled with {ss} pairs
+// and closed with close_actions().
+static int open_actions(sd_bus_message *reply) {
+	int ret = sd_bus_message_open_container(reply, 'e', "sv");
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_append_basic(reply, 's', "actions");
+	if (ret < 0) {
+		return ret;
+	}
 
-		ret = sd_bus_message_append(reply, "{sv}", "desktop-entry",
-			"s", notif->desktop_entry);
+	ret = sd_bus_message_open_container(reply, 'v', "a{ss}");
+	if (ret < 0) {
+		return ret;
+	}
+
+	return sd_bus_message_open_container(reply, 'a', "{ss}");
+}
+
+static int close_actions(sd_bus_message *reply) {
+	for (int i = 0; i < 3; ++i) {
+		int ret = sd_bus_message_close_container(reply);
 		if (ret < 0) {
 			return ret;
 		}
+	}
+	return 0;
+}
 
-		ret = sd_bus_message_append(reply, "{sv}", "summary",
-			"s", notif->summary);
+static int append_notification(sd_bus_message *reply,
+		struct mako_notification *notif, uint32_t fields) {
+	int ret = sd_bus_message_open_container(reply, 'a', "{sv}");
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = append_notification_fields(reply, fields, notif->id,
+		notif->app_name, notif->app_icon, notif->category,
+		notif->desktop_entry, notif->summary, notif->body, notif->urgency);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (!(fields & MAKO_NOTIFICATION_FIELD_ACTIONS)) {
+		return sd_bus_message_close_container(reply);
+	}
+
+	ret = open_actions(reply);
+	if (ret < 0) {
+		return ret;
+	}
+
+	struct mako_action *action;
+	wl_list_for_each(action, &notif->actions, link) {
+		ret = sd_bus_message_append(reply, "{ss}", action->key, action->title);
 		if (ret < 0) {
 			return ret;
 		}
+	}
+
+	ret = close_actions(reply);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return sd_bus_message_close_container(reply);
+}
+
+static int append_history_entry(sd_bus_message *reply,
+		struct mako_history_entry *entry, uint32_t fields) {
+	int ret = sd_bus_message_open_container(reply, 'a', "{sv}");
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = append_notification_fields(reply, fields, entry->id,
+		entry->app_name, entry->app_icon, entry->category,
+		entry->desktop_entry, entry->summary, entry->body, entry->urgency);
+	if (ret < 0) {
+		return ret;
+	}
 
-		ret = sd_bus_message_append(reply, "{sv}", "body",
-			"s", notif->body);
+	if (!(fields & MAKO_NOTIFICATION_FIELD_ACTIONS)) {
+		return sd_bus_message_close_container(reply);
+	}
+
+	ret = open_actions(reply);
+	if (ret < 0) {
+		return ret;
+	}
+
+	for (size_t i = 0; i < entry->actions_len; ++i) {
+		ret = sd_bus_message_append(reply, "{ss}", entry->actions[i].key,
+			entry->actions[i].title);
 		if (ret < 0) {
 			return ret;
 		}
+	}
+
+	ret = close_actions(reply);
+	if (ret < 0) {
+		return ret;
+	}
 
-		ret = sd_bus_message_append(reply, "{sv}", "id",
-			"u", notif->id);
+	return sd_bus_message_close_container(reply);
+}
+
+static int handle_list_for_each(sd_bus_message *reply, struct wl_list *list) {
+	int ret = sd_bus_message_open_container(reply, 'a', "a{sv}");
+	if (ret < 0) {
+		return ret;
+	}
+
+	struct mako_notification *notif;
+	wl_list_for_each(notif, list, link) {
+		ret = append_notification(reply, notif, MAKO_NOTIFICATION_FIELD_ALL);
 		if (ret < 0) {
 			return ret;
 		}
+	}
+
+	return sd_bus_message_close_container(reply);
+}
+
+static int handle_list_notifications(sd_bus_message *msg, void *data,
+		sd_bus_error *ret_error) {
+	struct mako_state *state = data;
+
+	sd_bus_message *reply = NULL;
+	int ret = sd_bus_message_new_method_return(msg, &reply);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = handle_list_for_each(reply, &state->notifications);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_send(NULL, reply, NULL);
+	if (ret < 0) {
+		return ret;
+	}
+
+	sd_bus_message_unref(reply);
+	return 0;
+}
 
-		ret = sd_bus_message_append(reply, "{sv}", "urgency",
-			"y", notif->urgency);
+static int handle_list_history(sd_bus_message *msg, void *data,
+		sd_bus_error *ret_error) {
+	struct mako_state *state = data;
+
+	sd_bus_message *reply = NULL;
+	int ret = sd_bus_message_new_method_return(msg, &reply);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_open_container(reply, 'a', "a{sv}");
+	if (ret < 0) {
+		return ret;
+	}
+
+	// Most recent first
+	struct mako_history_entry *entry;
+	for (size_t i = 0; (entry = get_history_entry(&state->history, i)); ++i) {
+		ret = append_history_entry(reply, entry, MAKO_NOTIFICATION_FIELD_ALL);
 		if (ret < 0) {
 			return ret;
 		}
+	}
+
+	ret = sd_bus_message_close_container(reply);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_send(NULL, reply, NULL);
+	if (ret < 0) {
+		return ret;
+	}
+
+	sd_bus_message_unref(reply);
+	return 0;
+}
+
+// Parameters of the QueryNotifications and QueryHistory methods
+struct mako_query {
+	struct mako_criteria *criteria; // NULL to match everything
+	uint32_t id; // Only match the notification with this id, if non-zero
+	uint32_t since_id; // Only match notifications with a greater id
+	uint32_t offset; // Number of matches to skip
+	uint32_t limit; // Maximum number of matches to return
+	uint32_t fields; // enum mako_notification_field
+};
+
+static void finish_query(struct mako_query *query) {
+	if (query->criteria != NULL) {
+		destroy_criteria(query->criteria);
+	}
+}
+
+static int parse_query_criteria(struct mako_query *query, const char *string,
+		sd_bus_error *ret_error) {
+	if (query->criteria != NULL) {
+		destroy_criteria(query->criteria);
+	}
+
+	// Not part of the configuration, so not in any list
+	query->criteria = calloc(1, sizeof(struct mako_criteria));
+	if (query->criteria == NULL) {
+		return -ENOMEM;
+	}
+	wl_list_init(&query->criteria->link);
+
+	if (!parse_criteria(string, query->criteria)) {
+		return sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS,
+			"Invalid criteria '%s'", string);
+	}
+	return 0;
+}
+
+static int parse_query_fields(struct mako_query *query, sd_bus_message *msg,
+		sd_bus_error *ret_error) {
+	int ret = sd_bus_message_enter_container(msg, 'v', "as");
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_enter_container(msg, 'a', "s");
+	if (ret < 0) {
+		return ret;
+	}
 
-		ret = sd_bus_message_open_container(reply, 'e', "sv");
+	query->fields = 0;
+	while (true) {
+		const char *name;
+		ret = sd_bus_message_read(msg, "s", &name);
 		if (ret < 0) {
 			return ret;
+		} else if (ret == 0) {
+			break;
 		}
 
-		ret = sd_bus_message_append_basic(reply, 's', "actions");
-		if (ret < 0) {
-			return ret;
+		size_t i = 0;
+		size_t n_fields = sizeof(notification_fields) / sizeof(notification_fields[0]);
+		while (i < n_fields && strcmp(notification_fields[i].name, name) != 0) {
+			++i;
+		}
+		if (i == n_fields) {
+			return sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS,
+				"Unknown field '%s'", name);
 		}
+		query->fields |= notification_fields[i].field;
+	}
 
-		ret = sd_bus_message_open_container(reply, 'v', "a{ss}");
+	ret = sd_bus_message_exit_container(msg);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return sd_bus_message_exit_container(msg);
+}
+
+static int parse_query(struct mako_query *query, sd_bus_message *msg,
+		sd_bus_error *ret_error) {
+	*query = (struct mako_query){
+		.limit = UINT32_MAX,
+		.fields = MAKO_NOTIFICATION_FIELD_ALL,
+	};
+
+	int ret = sd_bus_message_enter_container(msg, 'a', "{sv}");
+	if (ret < 0) {
+		return ret;
+	}
+
+	while (true) {
+		ret = sd_bus_message_enter_container(msg, 'e', "sv");
 		if (ret < 0) {
 			return ret;
+		} else if (ret == 0) {
+			break;
 		}
 
-		ret = sd_bus_message_open_container(reply, 'a', "{ss}");
+		const char *key = NULL;
+		ret = sd_bus_message_read(msg, "s", &key);
 		if (ret < 0) {
 			return ret;
 		}
 
-		struct mako_action *action;
-		wl_list_for_each(action, &notif->actions, link) {
-			ret = sd_bus_message_append(reply, "{ss}", action->key, action->title);
-			if (ret < 0) {
-				return ret;
+		if (strcmp(key, "criteria") == 0) {
+			const char *criteria = NULL;
+			ret = sd_bus_message_read(msg, "v", "s", &criteria);
+			if (ret >= 0) {
+				ret = parse_query_criteria(query, criteria, ret_error);
+			}
+		} else if (strcmp(key, "id") == 0) {
+			ret = sd_bus_message_read(msg, "v", "u", &query->id);
+		} else if (strcmp(key, "since-id") == 0) {
+			ret = sd_bus_message_read(msg, "v", "u", &query->since_id);
+		} else if (strcmp(key, "offset") == 0) {
+			ret = sd_bus_message_read(msg, "v", "u", &query->offset);
+		} else if (strcmp(key, "limit") == 0) {
+			ret = sd_bus_message_read(msg, "v", "u", &query->limit);
+			if (query->limit == 0) {
+				query->limit = UINT32_MAX;
 			}
+		} else if (strcmp(key, "fields") == 0) {
+			ret = parse_query_fields(query, msg, ret_error);
+		} else {
+			ret = sd_bus_message_skip(msg, "v");
 		}
-
-		ret = sd_bus_message_close_container(reply);
 		if (ret < 0) {
 			return ret;
 		}
 
-		ret = sd_bus_message_close_container(reply);
+		ret = sd_bus_message_exit_container(msg);
 		if (ret < 0) {
 			return ret;
 		}
+	}
 
-		ret = sd_bus_message_close_container(reply);
-		if (ret < 0) {
-			return ret;
-		}
+	return sd_bus_message_exit_container(msg);
+}
 
-		ret = sd_bus_message_close_container(reply);
-		if (ret < 0) {
-			return ret;
-		}
+// Accounts for the offset and the limit once an entry has matched. Returns
+// whether the entry should be part of the reply.
+static bool query_take(struct mako_query *query) {
+	if (query->offset > 0) {
+		--query->offset;
+		return false;
 	}
+	--query->limit;
+	return true;
+}
 
-	ret = sd_bus_message_close_container(reply);
+static bool query_match_notification(struct mako_query *query,
+		struct mako_notification *notif) {
+	if (notif->id <= query->since_id ||
+			(query->id != 0 && notif->id != query->id)) {
+		return false;
+	}
+	return query->criteria == NULL || match_criteria(query->criteria, notif);
+}
+
+static bool query_match_history_entry(struct mako_query *query,
+		struct mako_state *state, struct mako_history_entry *entry) {
+	if (entry->id <= query->since_id ||
+			(query->id != 0 && entry->id != query->id)) {
+		return false;
+	}
+	if (query->criteria == NULL) {
+		return true;
+	}
+
+	// Criteria match notifications, so look at the entry through one. It's
+	// not shown anywhere, and only the emptiness of the action list matters.
+	struct mako_notification notif = {
+		.state = state,
+		.id = entry->id,
+		.group_index = -1,
+		.app_name = entry->app_name,
+		.app_icon = entry->app_icon,
+		.summary = entry->summary,
+		.body = entry->body,
+		.requested_timeout = entry->requested_timeout,
+		.urgency = entry->urgency,
+		.category = entry->category,
+		.desktop_entry = entry->desktop_entry,
+		.tag = entry->tag,
+	};
+	struct wl_list action_link;
+	wl_list_init(&notif.actions);
+	if (entry->actions_len > 0) {
+		wl_list_insert(&notif.actions, &action_link);
+	}
+	return match_criteria(query->criteria, &notif);
+}
+
+static int append_query_results(sd_bus_message *reply,
+		struct mako_state *state, struct mako_query *query, bool history) {
+	int ret = sd_bus_message_open_container(reply, 'a', "a{sv}");
 	if (ret < 0) {
 		return ret;
 	}
 
-	return 0;
+	if (history) {
+		// Most recent first
+		struct mako_history_entry *entry;
+		for (size_t i = 0; query->limit > 0 &&
+				(entry = get_history_entry(&state->history, i)); ++i) {
+			if (!query_match_history_entry(query, state, entry) ||
+					!query_take(query)) {
+				continue;
+			}
+			ret = append_history_entry(reply, entry, query->fields);
+			if (ret < 0) {
+				return ret;
+			}
+		}
+	} else {
+		struct mako_notification *notif;
+		wl_list_for_each(notif, &state->notifications, link) {
+			if (query->limit == 0) {
+				break;
+			}
+			if (!query_match_notification(query, notif) ||
+					!query_take(query)) {
+				continue;
+			}
+			ret = append_notification(reply, notif, query->fields);
+			if (ret < 0) {
+				return ret;
+			}
+		}
+	}
+
+	return sd_bus_message_close_container(reply);
 }
 
-static int handle_list(sd_bus_message *msg, struct wl_list *list) {
+static int handle_query(sd_bus_message *msg, struct mako_state *state,
+		bool history, sd_bus_error *ret_error) {
+	struct mako_query query;
 	sd_bus_message *reply = NULL;
-	int ret = sd_bus_message_new_method_return(msg, &reply);
+	int ret = parse_query(&query, msg, ret_error);
 	if (ret < 0) {
-		return ret;
+		goto out;
 	}
 
-	ret = handle_list_for_each(reply, list);
+	ret = sd_bus_message_new_method_return(msg, &reply);
 	if (ret < 0) {
-		return ret;
+		goto out;
 	}
 
-	ret = sd_bus_send(NULL, reply, NULL);
+	ret = append_query_results(reply, state, &query, history);
 	if (ret < 0) {
-		return ret;
+		goto out;
 	}
 
+	ret = sd_bus_send(NULL, reply, NULL);
+
+out:
 	sd_bus_message_unref(reply);
-	return 0;
+	finish_query(&query);
+	return ret < 0 ? ret : 0;
 }
 
-static int handle_list_notifications(sd_bus_message *msg, void *data,
+static int handle_query_notifications(sd_bus_message *msg, void *data,
 		sd_bus_error *ret_error) {
-	struct mako_state *state = data;
-	return handle_list(msg, &state->notifications);
+	return handle_query(msg, data, false, ret_error);
 }
 
-static int handle_list_history(sd_bus_message *msg, void *data,
+static int handle_query_history(sd_bus_message *msg, void *data,
 		sd_bus_error *ret_error) {
-	struct mako_state *state = data;
-	return handle_list(msg, &state->history);
+	return handle_query(msg, data, true, ret_error);
 }
 
 /**
@@ -305,29 +721,34 @@ static void reapply_config(struct mako_state *state) {
 		destroy_surface(surface);
 	}
 
+	// Regrouping may move notifications around, so take a snapshot of the
+	// list first.
+	struct wl_array notifs;
+	wl_array_init(&notifs);
 	struct mako_notification *notif;
 	wl_list_for_each(notif, &state->notifications, link) {
-		// Reset the notifications' grouped state so that if criteria have been
-		// removed they'll separate properly.
-		notif->group_index = -1;
-		/* Also reset the notif->surface so it gets reasigned to default
+		struct mako_notification **notif_ptr =
+			wl_array_add(&notifs, sizeof(struct mako_notification *));
+		if (notif_ptr == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			break;
+		}
+		*notif_ptr = notif;
+	}
+
+	struct mako_notification **notif_ptr;
+	wl_array_for_each(notif_ptr, &notifs) {
+		notif = *notif_ptr;
+		/* Reset the notif->surface so it gets reasigned to default
 		 * if appropriate */
 		notif->surface = NULL;
 
-		finish_style(&notif->style);
-		init_empty_style(&notif->style);
-		apply_each_criteria(&state->config.criteria, notif);
+		resolve_notification_style(notif);
 
-		// Having to do this for every single notification really hurts... but
-		// it does do The Right Thing (tm).
-		struct mako_criteria *notif_criteria = create_criteria_from_notification(
-				notif, &notif->style.group_criteria_spec);
-		if (!notif_criteria) {
-			continue;
-		}
-		group_notifications(state, notif_criteria);
-		free(notif_criteria);
+		// Only notifications whose group-by criteria changed are regrouped.
+		group_notification(notif);
 	}
+	wl_array_release(&notifs);
 
 	wl_list_for_each(surface, &state->surfaces, link) {
 		set_dirty(surface);
@@ -362,6 +783,7 @@ static int handle_reload(sd_bus_message *msg, void *data,
 		return -1;
 	}
 
+	update_history_log(state);
 	reapply_config(state);
 
 	return sd_bus_reply_method_return(msg, "");
@@ -444,6 +866,83 @@ static int handle_set_modes(sd_bus_message *msg, void *data,
 	return sd_bus_reply_method_return(msg, "");
 }
 
+static int handle_get_statistics(sd_bus_message *msg, void *data,
+		sd_bus_error *ret_error) {
+	struct mako_state *state = data;
+
+	sd_bus_message *reply = NULL;
+	int ret = sd_bus_message_new_method_return(msg, &reply);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_open_container(reply, 'a', "{sv}");
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_append(reply, "{sv}", "style-cache-hits",
+		"t", state->stats.style_hits);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_append(reply, "{sv}", "style-cache-misses",
+		"t", state->stats.style_misses);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_append(reply, "{sv}", "tile-cache-hits",
+		"t", state->stats.tile_hits);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_append(reply, "{sv}", "tile-cache-misses",
+		"t", state->stats.tile_misses);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_append(reply, "{sv}", "icon-cache-hits",
+		"t", state->stats.icon_hits);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_append(reply, "{sv}", "icon-cache-misses",
+		"t", state->stats.icon_misses);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_append(reply, "{sv}", "notify-calls",
+		"t", state->stats.notify_calls);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_append(reply, "{sv}", "notify-time-ns",
+		"t", state->stats.notify_ns);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_close_container(reply);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_send(NULL, reply, NULL);
+	if (ret < 0) {
+		return ret;
+	}
+
+	sd_bus_message_unref(reply);
+	return 0;
+}
+
 static int get_modes(sd_bus *bus, const char *path,
 		     const char *interface, const char *property,
 		     sd_bus_message *reply, void *data,
@@ -490,10 +989,66 @@ static int get_notifications(sd_bus *bus, const char *path,
 	return 0;
 }
 
-void emit_notifications_changed(struct mako_state *state) {
+static void handle_notifications_changed_idle(void *data) {
+	struct mako_state *state = data;
+	state->notifications_changed_idle = NULL;
 	sd_bus_emit_properties_changed(state->bus, service_path, service_interface, "Notifications", NULL);
 }
 
+// Invalidating the property makes clients fetch the whole list again, so only
+// do it once per event loop iteration.
+void emit_notifications_changed(struct mako_state *state) {
+	if (state->notifications_changed_idle != NULL) {
+		return;
+	}
+	state->notifications_changed_idle = add_event_loop_idle(&state->event_loop,
+		handle_notifications_changed_idle, state);
+	if (state->notifications_changed_idle == NULL) {
+		sd_bus_emit_properties_changed(state->bus, service_path, service_interface, "Notifications", NULL);
+	}
+}
+
+static void emit_notification_signal(struct mako_notification *notif,
+		const char *member) {
+	struct mako_state *state = notif->state;
+
+	sd_bus_message *signal = NULL;
+	int ret = sd_bus_message_new_signal(state->bus, &signal, service_path,
+		service_interface, member);
+	if (ret < 0) {
+		goto out;
+	}
+
+	ret = append_notification(signal, notif, MAKO_NOTIFICATION_FIELD_ALL);
+	if (ret < 0) {
+		goto out;
+	}
+
+	ret = sd_bus_send(state->bus, signal, NULL);
+
+out:
+	if (ret < 0) {
+		fprintf(stderr, "Failed to emit %s signal: %s\n", member,
+			strerror(-ret));
+	}
+	sd_bus_message_unref(signal);
+}
+
+void emit_notification_added(struct mako_notification *notif) {
+	emit_notification_signal(notif, "NotificationAdded");
+}
+
+void emit_notification_updated(struct mako_notification *notif) {
+	emit_notification_signal(notif, "NotificationUpdated");
+}
+
+void emit_notification_removed(struct mako_notification *notif,
+		enum mako_notification_close_reason reason) {
+	struct mako_state *state = notif->state;
+	sd_bus_emit_signal(state->bus, service_path, service_interface,
+		"NotificationRemoved", "uu", notif->id, reason);
+}
+
 static const sd_bus_vtable service_vtable[] = {
 	SD_BUS_VTABLE_START(0),
 	SD_BUS_METHOD("DismissNotifications", "a{sv}", "", handle_dismiss, SD_BUS_VTABLE_UNPRIVILEGED),
@@ -501,12 +1056,18 @@ static const sd_bus_vtable service_vtable[] = {
 	SD_BUS_METHOD("RestoreNotification", "", "", handle_restore_action, SD_BUS_VTABLE_UNPRIVILEGED),
 	SD_BUS_METHOD("ListNotifications", "", "aa{sv}", handle_list_notifications, SD_BUS_VTABLE_UNPRIVILEGED),
 	SD_BUS_METHOD("ListHistory", "", "aa{sv}", handle_list_history, SD_BUS_VTABLE_UNPRIVILEGED),
+	SD_BUS_METHOD("QueryNotifications", "a{sv}", "aa{sv}", handle_query_notifications, SD_BUS_VTABLE_UNPRIVILEGED),
+	SD_BUS_METHOD("QueryHistory", "a{sv}", "aa{sv}", handle_query_history, SD_BUS_VTABLE_UNPRIVILEGED),
 	SD_BUS_METHOD("Reload", "", "", handle_reload, SD_BUS_VTABLE_UNPRIVILEGED),
 	SD_BUS_METHOD("SetMode", "s", "", handle_set_mode, SD_BUS_VTABLE_UNPRIVILEGED),
 	SD_BUS_METHOD("ListModes", "", "as", handle_list_modes, SD_BUS_VTABLE_UNPRIVILEGED),
 	SD_BUS_METHOD("SetModes", "as", "", handle_set_modes, SD_BUS_VTABLE_UNPRIVILEGED),
+	SD_BUS_METHOD("GetStatistics", "", "a{sv}", handle_get_statistics, SD_BUS_VTABLE_UNPRIVILEGED),
 	SD_BUS_PROPERTY("Modes", "as", get_modes, 0, SD_BUS_VTABLE_PROPERTY_EMITS_INVALIDATION),
 	SD_BUS_PROPERTY("Notifications", "aa{sv}", get_notifications, 0, SD_BUS_VTABLE_PROPERTY_EMITS_INVALIDATION),
+	SD_BUS_SIGNAL("NotificationAdded", "a{sv}", 0),
+	SD_BUS_SIGNAL("NotificationUpdated", "a{sv}", 0),
+	SD_BUS_SIGNAL("NotificationRemoved", "uu", 0),
 	SD_BUS_VTABLE_END
 };
 
@@ -1,6 +1,9 @@
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "config.h"
 #include "criteria.h"
@@ -14,6 +17,33 @@
 static const char *service_path = "/org/freedesktop/Notifications";
 static const char *service_interface = "org.freedesktop.Notifications";
 
+static bool validate_image_data(const struct mako_image_data *image_data,
+		size_t data_len) {
+	// GdkPixbuf only handles 8-bit RGB and RGBA.
+	if (image_data->bits_per_sample != 8 ||
+			image_data->channels != (image_data->has_alpha ? 4 : 3)) {
+		return false;
+	}
+	if (image_data->width <= 0 || image_data->height <= 0 ||
+			image_data->rowstride <= 0) {
+		return false;
+	}
+
+	size_t row_len = (size_t)image_data->width * image_data->channels;
+	if ((size_t)image_data->rowstride < row_len) {
+		return false;
+	}
+
+	// The last row doesn't need to be padded up to rowstride:
+	// len = (height - 1) * rowstride + width * channels
+	size_t height = image_data->height;
+	if (height - 1 > (SIZE_MAX - row_len) / (size_t)image_data->rowstride) {
+		return false;
+	}
+	size_t image_len = (height - 1) * image_data->rowstride + row_len;
+	return data_len >= image_len;
+}
+
 static int handle_get_capabilities(sd_bus_message *msg, void *data,
 		sd_bus_error *ret_error) {
 	struct mako_state *state = data;
@@ -83,16 +113,19 @@ static int handle_get_capabilities(sd_bus_message *msg, void *data,
 
 static void handle_notification_timer(void *data) {
 	struct mako_notification *notif = data;
-	struct mako_surface *surface = notif->surface;
+	struct mako_state *state = notif->state;
 	notif->timer = NULL;
 
-	close_notification(notif, MAKO_NOTIFICATION_CLOSE_EXPIRED, true);
-	set_dirty(surface);
+	// With timer-slack, a burst of notifications usually expires at once.
+	// They are closed together once all of the due timers have run, so that
+	// they are regrouped and redrawn only once.
+	wl_list_insert(state->expired_notifications.prev, &notif->expired_link);
 }
 
-static int handle_notify(sd_bus_message *msg, void *data,
+static void ingest_notifications(void *data);
+
+static int process_notify(sd_bus_message *msg, struct mako_state *state,
 		sd_bus_error *ret_error) {
-	struct mako_state *state = data;
 	int ret = 0;
 
 	const char *app_name, *app_icon, *summary, *body;
@@ -282,47 +315,28 @@ static int handle_notify(sd_bus_message *msg, void *data,
 				return ret;
 			}
 
-			// Calculate the expected useful data length without padding in last row
-			// len = size before last row + size of last row
-			//     = (height - 1) * rowstride + width * ceil(channels * bits_pre_sample / 8.0)
-			size_t image_len = (image_data->height - 1) * image_data->rowstride +
-				image_data->width * ((image_data->channels *
-				image_data->bits_per_sample + 7) / 8);
-			uint8_t *data = calloc(image_len, sizeof(uint8_t));
-			if (data == NULL) {
-				free(image_data);
-				return -1;
-			}
-
-			ret = sd_bus_message_enter_container(msg, 'a', "y");
+			// The pixels are borrowed straight from the message buffer. The
+			// message is referenced through notif->image_msg until the
+			// notification is ingested or reset, see ingest_notification().
+			const void *data = NULL;
+			size_t data_len = 0;
+			ret = sd_bus_message_read_array(msg, 'y', &data, &data_len);
 			if (ret < 0) {
-				free(data);
 				free(image_data);
 				return ret;
 			}
 
-			// Ignore the extra padding bytes in the last row if exist
-			for (size_t index = 0; index < image_len; index++) {
-				uint8_t tmp;
-				ret = sd_bus_message_read(msg, "y", &tmp);
-				if (ret < 0){
-					free(data);
-					free(image_data);
-					return ret;
-				}
-				data[index] = tmp;
-			}
-
-			image_data->data = data;
-			if (notif->image_data != NULL) {
-				free(notif->image_data->data);
+			if (validate_image_data(image_data, data_len)) {
+				image_data->data = data;
 				free(notif->image_data);
-			}
-			notif->image_data = image_data;
-
-			ret = sd_bus_message_exit_container(msg);
-			if (ret < 0) {
-				return ret;
+				notif->image_data = image_data;
+			} else {
+				fprintf(stderr, "Ignoring malformed image data "
+					"(%dx%d, rowstride %d, %d channels, %d bits, %zu bytes)\n",
+					image_data->width, image_data->height,
+					image_data->rowstride, image_data->channels,
+					image_data->bits_per_sample, data_len);
+				free(image_data);
 			}
 
 			ret = sd_bus_message_exit_container(msg);
@@ -359,11 +373,16 @@ static int handle_notify(sd_bus_message *msg, void *data,
 	}
 	notif->requested_timeout = requested_timeout;
 
+	// Whether subscribers were told about the notification it replaces, if
+	// any: one which wasn't ingested yet was never announced
+	bool replaced_added = true;
 	if (notif->tag) {
 		// Find and replace the existing notfication with a matching tag
 		struct mako_notification *replace_notif = get_tagged_notification(state, notif->tag, app_name);
 		if (replace_notif) {
 			notif->id = replace_notif->id;
+			replaced_added = !notification_is_pending(replace_notif) ||
+				replace_notif->pending_replace;
 			wl_list_insert(&replace_notif->link, &notif->link);
 			destroy_notification(replace_notif);
 			replaces_id = notif->id;
@@ -380,22 +399,69 @@ static int handle_notify(sd_bus_message *msg, void *data,
 		// Only insert notifications if they're actually new, to avoid creating
 		// duplicates in the list.
 		insert_notification(state, notif);
+	} else {
+		// It took the place of another one, but its tag may have changed.
+		index_notification(notif);
 	}
 
-	int match_count = apply_each_criteria(&state->config.criteria, notif);
+	// The image data points into msg
+	if (notif->image_data != NULL && notif->image_msg == NULL) {
+		notif->image_msg = sd_bus_message_ref(msg);
+	}
+
+	// Everything else is done once per event loop iteration, for all of the
+	// notifications received in the meantime, see ingest_notifications().
+	// This way a burst of notifications is only laid out and drawn once, and
+	// the senders get their reply right away.
+	if (!notification_is_pending(notif)) {
+		notif->pending_replace = replaces_id == notif->id && replaced_added;
+		wl_list_insert(state->pending_notifications.prev, &notif->pending_link);
+	}
+	if (state->ingest_idle == NULL) {
+		state->ingest_idle = add_event_loop_idle(&state->event_loop,
+			ingest_notifications, state);
+		if (state->ingest_idle == NULL) {
+			ingest_notifications(state);
+		}
+	}
+
+	return sd_bus_reply_method_return(msg, "u", notif->id);
+}
+
+// The time spent here is reported by GetStatistics, see bench/notify.c
+static int handle_notify(sd_bus_message *msg, void *data,
+		sd_bus_error *ret_error) {
+	struct mako_state *state = data;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int ret = process_notify(msg, state, ret_error);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	++state->stats.notify_calls;
+	state->stats.notify_ns += (end.tv_sec - start.tv_sec) * UINT64_C(1000000000)
+		+ end.tv_nsec - start.tv_nsec;
+	return ret;
+}
+
+// Returns false if the notification had to be dropped.
+static bool ingest_notification(struct mako_notification *notif) {
+	struct mako_state *state = notif->state;
+
+	int match_count = resolve_notification_style(notif);
 	if (match_count == -1) {
 		// We encountered an allocation failure or similar while applying
 		// criteria. The notification may be partially matched, but the worst
 		// case is that it has an empty style, so bail.
 		fprintf(stderr, "Failed to apply criteria\n");
-		destroy_notification(notif);
-		return -1;
+		close_notification(notif, MAKO_NOTIFICATION_CLOSE_UNKNOWN, false);
+		return false;
 	} else if (match_count == 0) {
 		// This should be impossible, since the global criteria is always
 		// present in a mako_config and matches everything.
 		fprintf(stderr, "Notification matched zero criteria?!\n");
-		destroy_notification(notif);
-		return -1;
+		close_notification(notif, MAKO_NOTIFICATION_CLOSE_UNKNOWN, false);
+		return false;
 	}
 
 	int32_t expire_timeout = notif->requested_timeout;
@@ -405,33 +471,62 @@ static int handle_notify(sd_bus_message *msg, void *data,
 
 	if (expire_timeout > 0) {
 		notif->timer = add_event_loop_timer(&state->event_loop, expire_timeout,
-			handle_notification_timer, notif);
+			state->config.timer_slack, handle_notification_timer, notif);
 	}
 
 	if (notif->style.icons) {
 		notif->icon = create_icon(notif);
 	}
 
+	// The image data points into the message, which can be released now
+	free(notif->image_data);
+	notif->image_data = NULL;
+	sd_bus_message_unref(notif->image_msg);
+	notif->image_msg = NULL;
+
 	// Now we need to perform the grouping based on the new notification's
 	// group criteria specification (list of criteria which must match). We
 	// don't necessarily want to start with the new notification, as depending
 	// on the sort criteria, there may be matching ones earlier in the list.
 	// After this call, the matching notifications will be contiguous in the
 	// list, and the first one that matches will always still be first.
-	struct mako_criteria *notif_criteria = create_criteria_from_notification(
-			notif, &notif->style.group_criteria_spec);
-	if (!notif_criteria) {
-		destroy_notification(notif);
-		return -1;
+	group_notification(notif);
+
+	if (notif->pending_replace) {
+		emit_notification_updated(notif);
+		// The list itself didn't change, but this entry did
+		emit_notifications_changed(state);
+	} else {
+		emit_notification_added(notif);
 	}
-	group_notifications(state, notif_criteria);
-	destroy_criteria(notif_criteria);
 
 	notification_execute_binding(notif, &notif->style.notify_binding, NULL);
+	return true;
+}
 
-	set_dirty(notif->surface);
+static void ingest_notifications(void *data) {
+	struct mako_state *state = data;
+	state->ingest_idle = NULL;
 
-	return sd_bus_reply_method_return(msg, "u", notif->id);
+	struct wl_array surfaces; // struct mako_surface *
+	wl_array_init(&surfaces);
+
+	while (!wl_list_empty(&state->pending_notifications)) {
+		struct mako_notification *notif = wl_container_of(
+			state->pending_notifications.next, notif, pending_link);
+		wl_list_remove(&notif->pending_link);
+		wl_list_init(&notif->pending_link);
+
+		if (ingest_notification(notif)) {
+			add_dirty_surface(&surfaces, notif->surface);
+		}
+	}
+
+	struct mako_surface **surface_ptr;
+	wl_array_for_each(surface_ptr, &surfaces) {
+		set_dirty(*surface_ptr);
+	}
+	wl_array_release(&surfaces);
 }
 
 static int handle_close_notification(sd_bus_message *msg, void *data,
@@ -1,6 +1,9 @@
 #include <errno.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/timerfd.h>
 #include <signal.h>
 #include <sys/signalfd.h>
@@ -23,7 +26,7 @@ static int init_signalfd() {
 		return -1;
 	}
 
-	if ((sfd = signalfd(-1, &mask, SFD_NONBLOCK)) == -1) {
+	if ((sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
 		fprintf(stderr, "signalfd: %s", strerror(errno));
 		return -1;
 	}
@@ -31,47 +34,156 @@ static int init_signalfd() {
 	return sfd;
 }
 
+static int handle_signal(int fd, uint32_t events, void *data);
+static int handle_dbus(int fd, uint32_t events, void *data);
+static int handle_wayland(int fd, uint32_t events, void *data);
+static int handle_timer(int fd, uint32_t events, void *data);
+
 bool init_event_loop(struct mako_event_loop *loop, sd_bus *bus,
 		struct wl_display *display) {
-	if ((loop->sfd = init_signalfd()) == -1) {
+	loop->bus = bus;
+	loop->display = display;
+	loop->sfd = loop->timer_fd = -1;
+	wl_list_init(&loop->sources);
+	wl_list_init(&loop->destroyed_sources);
+	wl_array_init(&loop->timers);
+	loop->timer_armed = false;
+	loop->timers_done_func = NULL;
+	loop->timers_done_data = NULL;
+	wl_list_init(&loop->idles);
+
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) {
+		fprintf(stderr, "epoll_create1: %s\n", strerror(errno));
 		return false;
 	}
 
-	loop->fds[MAKO_EVENT_SIGNAL] = (struct pollfd){
-		.fd = loop->sfd,
-		.events = POLLIN,
-	};
+	if ((loop->sfd = init_signalfd()) == -1) {
+		goto error;
+	}
 
-	loop->fds[MAKO_EVENT_DBUS] = (struct pollfd){
-		.fd = sd_bus_get_fd(bus),
-		.events = POLLIN,
-	};
+	loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (loop->timer_fd < 0) {
+		fprintf(stderr, "timerfd_create: %s\n", strerror(errno));
+		goto error;
+	}
 
-	loop->fds[MAKO_EVENT_WAYLAND] = (struct pollfd){
-		.fd = wl_display_get_fd(display),
-		.events = POLLIN,
-	};
+	loop->signal_source =
+		add_event_loop_fd(loop, loop->sfd, EPOLLIN, handle_signal, loop);
+	loop->dbus_source = add_event_loop_fd(loop, sd_bus_get_fd(bus), EPOLLIN,
+		handle_dbus, loop);
+	loop->wayland_source = add_event_loop_fd(loop,
+		wl_display_get_fd(display), EPOLLIN, handle_wayland, loop);
+	loop->timer_source =
+		add_event_loop_fd(loop, loop->timer_fd, EPOLLIN, handle_timer, loop);
+	if (loop->signal_source == NULL || loop->dbus_source == NULL ||
+			loop->wayland_source == NULL || loop->timer_source == NULL) {
+		goto error;
+	}
 
-	loop->fds[MAKO_EVENT_TIMER] = (struct pollfd){
-		.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC),
-		.events = POLLIN,
-	};
+	return true;
 
-	loop->bus = bus;
-	loop->display = display;
-	wl_list_init(&loop->timers);
+error:
+	finish_event_loop(loop);
+	return false;
+}
 
-	return true;
+static void free_sources(struct wl_list *sources) {
+	struct mako_event_source *source, *tmp;
+	wl_list_for_each_safe(source, tmp, sources, link) {
+		wl_list_remove(&source->link);
+		free(source);
+	}
 }
 
 void finish_event_loop(struct mako_event_loop *loop) {
-	close(loop->fds[MAKO_EVENT_TIMER].fd);
-	loop->fds[MAKO_EVENT_TIMER].fd = -1;
+	free_sources(&loop->sources);
+	free_sources(&loop->destroyed_sources);
+	loop->signal_source = loop->dbus_source = NULL;
+	loop->wayland_source = loop->timer_source = NULL;
+
+	if (loop->timer_fd >= 0) {
+		close(loop->timer_fd);
+		loop->timer_fd = -1;
+	}
+	if (loop->sfd >= 0) {
+		close(loop->sfd);
+		loop->sfd = -1;
+	}
+	if (loop->epoll_fd >= 0) {
+		close(loop->epoll_fd);
+		loop->epoll_fd = -1;
+	}
+
+	struct mako_timer **timers = loop->timers.data;
+	size_t len = loop->timers.size / sizeof(struct mako_timer *);
+	for (size_t i = 0; i < len; ++i) {
+		free(timers[i]);
+	}
+	wl_array_release(&loop->timers);
+	wl_array_init(&loop->timers);
+
+	struct mako_idle *idle, *tmp;
+	wl_list_for_each_safe(idle, tmp, &loop->idles, link) {
+		destroy_idle(idle);
+	}
+}
+
+struct mako_event_source *add_event_loop_fd(struct mako_event_loop *loop,
+		int fd, uint32_t events, mako_event_loop_fd_func_t func, void *data) {
+	struct mako_event_source *source = calloc(1, sizeof(struct mako_event_source));
+	if (source == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return NULL;
+	}
+	source->event_loop = loop;
+	source->fd = fd;
+	source->events = events;
+	source->func = func;
+	source->user_data = data;
+
+	struct epoll_event ev = { .events = events, .data.ptr = source };
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		fprintf(stderr, "failed to add FD %d to epoll: %s\n", fd,
+			strerror(errno));
+		free(source);
+		return NULL;
+	}
+
+	wl_list_insert(loop->sources.prev, &source->link);
+	return source;
+}
+
+bool update_event_source(struct mako_event_source *source, uint32_t events) {
+	if (source->events == events) {
+		return true;
+	}
 
-	struct mako_timer *timer, *tmp;
-	wl_list_for_each_safe(timer, tmp, &loop->timers, link) {
-		destroy_timer(timer);
+	struct mako_event_loop *loop = source->event_loop;
+	struct epoll_event ev = { .events = events, .data.ptr = source };
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &ev) < 0) {
+		fprintf(stderr, "failed to modify FD %d in epoll: %s\n", source->fd,
+			strerror(errno));
+		return false;
 	}
+	source->events = events;
+	return true;
+}
+
+void destroy_event_source(struct mako_event_source *source) {
+	if (source == NULL) {
+		return;
+	}
+	struct mako_event_loop *loop = source->event_loop;
+
+	// The FD may already be closed, in which case the kernel has dropped it
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+
+	// Events for this source may still be pending in the current iteration,
+	// so it can't be freed yet
+	wl_list_remove(&source->link);
+	wl_list_insert(&loop->destroyed_sources, &source->link);
+	source->fd = -1;
 }
 
 static void timespec_add(struct timespec *t, int delta_ms) {
@@ -89,42 +201,146 @@ static void timespec_add(struct timespec *t, int delta_ms) {
 	}
 }
 
-static bool timespec_less(struct timespec *t1, struct timespec *t2) {
+static bool timespec_less(const struct timespec *t1, const struct timespec *t2) {
 	if (t1->tv_sec != t2->tv_sec) {
 		return t1->tv_sec < t2->tv_sec;
 	}
 	return t1->tv_nsec < t2->tv_nsec;
 }
 
+static size_t timer_heap_len(struct mako_event_loop *loop) {
+	return loop->timers.size / sizeof(struct mako_timer *);
+}
+
+static struct mako_timer *timer_heap_top(struct mako_event_loop *loop) {
+	if (loop->timers.size == 0) {
+		return NULL;
+	}
+	struct mako_timer **timers = loop->timers.data;
+	return timers[0];
+}
+
+static void timer_heap_set(struct mako_timer **timers, size_t i,
+		struct mako_timer *timer) {
+	timers[i] = timer;
+	timer->heap_index = i;
+}
+
+static void timer_heap_sift_up(struct mako_event_loop *loop, size_t i) {
+	struct mako_timer **timers = loop->timers.data;
+	struct mako_timer *timer = timers[i];
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!timespec_less(&timer->at, &timers[parent]->at)) {
+			break;
+		}
+		timer_heap_set(timers, i, timers[parent]);
+		i = parent;
+	}
+	timer_heap_set(timers, i, timer);
+}
+
+static void timer_heap_sift_down(struct mako_event_loop *loop, size_t i) {
+	struct mako_timer **timers = loop->timers.data;
+	size_t len = timer_heap_len(loop);
+	struct mako_timer *timer = timers[i];
+	while (true) {
+		size_t child = 2 * i + 1;
+		if (child >= len) {
+			break;
+		}
+		if (child + 1 < len &&
+				timespec_less(&timers[child + 1]->at, &timers[child]->at)) {
+			++child;
+		}
+		if (!timespec_less(&timers[child]->at, &timer->at)) {
+			break;
+		}
+		timer_heap_set(timers, i, timers[child]);
+		i = child;
+	}
+	timer_heap_set(timers, i, timer);
+}
+
+static bool timer_heap_insert(struct mako_event_loop *loop,
+		struct mako_timer *timer) {
+	struct mako_timer **slot =
+		wl_array_add(&loop->timers, sizeof(struct mako_timer *));
+	if (slot == NULL) {
+		return false;
+	}
+	*slot = timer;
+	timer_heap_sift_up(loop, timer_heap_len(loop) - 1);
+	return true;
+}
+
+static void timer_heap_remove(struct mako_event_loop *loop,
+		struct mako_timer *timer) {
+	struct mako_timer **timers = loop->timers.data;
+	size_t i = timer->heap_index;
+	size_t last = timer_heap_len(loop) - 1;
+	loop->timers.size -= sizeof(struct mako_timer *);
+	if (i == last) {
+		return;
+	}
+
+	// Move the last timer into the hole and restore the heap property
+	timer_heap_set(timers, i, timers[last]);
+	if (i > 0 && timespec_less(&timers[i]->at, &timers[(i - 1) / 2]->at)) {
+		timer_heap_sift_up(loop, i);
+	} else {
+		timer_heap_sift_down(loop, i);
+	}
+}
+
+// Arms the timerfd for the earliest deadline, if it changed.
 static void update_event_loop_timer(struct mako_event_loop *loop) {
-	int timer_fd = loop->fds[MAKO_EVENT_TIMER].fd;
+	int timer_fd = loop->timer_fd;
 	if (timer_fd < 0) {
 		return;
 	}
 
-	bool updated = false;
-	struct mako_timer *timer;
-	wl_list_for_each(timer, &loop->timers, link) {
-		if (loop->next_timer == NULL ||
-				timespec_less(&timer->at, &loop->next_timer->at)) {
-			loop->next_timer = timer;
-			updated = true;
+	struct mako_timer *next_timer = timer_heap_top(loop);
+	struct itimerspec delay = {0};
+	if (next_timer != NULL) {
+		if (loop->timer_armed &&
+				next_timer->at.tv_sec == loop->timer_armed_at.tv_sec &&
+				next_timer->at.tv_nsec == loop->timer_armed_at.tv_nsec) {
+			return;
 		}
+		delay.it_value = next_timer->at;
+		loop->timer_armed = true;
+		loop->timer_armed_at = next_timer->at;
+	} else if (loop->timer_armed) {
+		// Disarm
+		loop->timer_armed = false;
+	} else {
+		return;
 	}
 
-	if (updated) {
-		struct itimerspec delay = { .it_value = loop->next_timer->at };
-		errno = 0;
-		int ret = timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &delay, NULL);
-		if (ret < 0) {
-			fprintf(stderr, "failed to timerfd_settime(): %s\n",
-				strerror(errno));
-		}
+	errno = 0;
+	int ret = timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &delay, NULL);
+	if (ret < 0) {
+		fprintf(stderr, "failed to timerfd_settime(): %s\n",
+			strerror(errno));
 	}
 }
 
+// Rounds a deadline up to the next multiple of `slack_ms`, so that timers
+// added around the same time expire together.
+static void timespec_round_up(struct timespec *t, int slack_ms) {
+	static const long ms = 1000000, s = 1000000000;
+
+	int64_t slack_ns = (int64_t)slack_ms * ms;
+	int64_t ns = (int64_t)t->tv_sec * s + t->tv_nsec;
+	ns = (ns + slack_ns - 1) / slack_ns * slack_ns;
+	t->tv_sec = ns / s;
+	t->tv_nsec = ns % s;
+}
+
 struct mako_timer *add_event_loop_timer(struct mako_event_loop *loop,
-		int delay_ms, mako_event_loop_timer_func_t func, void *data) {
+		int delay_ms, int slack_ms, mako_event_loop_timer_func_t func,
+		void *data) {
 	struct mako_timer *timer = calloc(1, sizeof(struct mako_timer));
 	if (timer == NULL) {
 		fprintf(stderr, "allocation failed\n");
@@ -133,10 +349,18 @@ struct mako_timer *add_event_loop_timer(struct mako_event_loop *loop,
 	timer->event_loop = loop;
 	timer->func = func;
 	timer->user_data = data;
-	wl_list_insert(&loop->timers, &timer->link);
 
 	clock_gettime(CLOCK_MONOTONIC, &timer->at);
 	timespec_add(&timer->at, delay_ms);
+	if (slack_ms > 0) {
+		timespec_round_up(&timer->at, slack_ms);
+	}
+
+	if (!timer_heap_insert(loop, timer)) {
+		fprintf(stderr, "allocation failed\n");
+		free(timer);
+		return NULL;
+	}
 
 	update_event_loop_timer(loop);
 	return timer;
@@ -148,35 +372,203 @@ void destroy_timer(struct mako_timer *timer) {
 	}
 	struct mako_event_loop *loop = timer->event_loop;
 
-	if (loop->next_timer == timer) {
-		loop->next_timer = NULL;
-	}
-
-	wl_list_remove(&timer->link);
+	timer_heap_remove(loop, timer);
 	free(timer);
 
 	update_event_loop_timer(loop);
 }
 
-static void handle_event_loop_timer(struct mako_event_loop *loop) {
-	int timer_fd = loop->fds[MAKO_EVENT_TIMER].fd;
+static int handle_timer(int fd, uint32_t events, void *data) {
+	struct mako_event_loop *loop = data;
+	(void)events;
+
 	uint64_t expirations;
-	ssize_t n = read(timer_fd, &expirations, sizeof(expirations));
-	if (n < 0) {
+	ssize_t n = read(fd, &expirations, sizeof(expirations));
+	if (n < 0 && errno == EAGAIN) {
+		// Re-armed since epoll_wait() returned
+		return 0;
+	} else if (n < 0) {
 		fprintf(stderr, "failed to read from timer FD\n");
+		return 0;
+	}
+
+	// The timerfd is no longer armed once it has fired
+	loop->timer_armed = false;
+
+	// Run all of the timers which are due in a single pass. Timers may add
+	// or destroy other timers from their callback.
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	struct mako_timer *timer;
+	bool ran = false;
+	while ((timer = timer_heap_top(loop)) != NULL &&
+			!timespec_less(&now, &timer->at)) {
+		mako_event_loop_timer_func_t func = timer->func;
+		void *user_data = timer->user_data;
+		timer_heap_remove(loop, timer);
+		free(timer);
+
+		func(user_data);
+		ran = true;
+	}
+
+	if (ran && loop->timers_done_func != NULL) {
+		loop->timers_done_func(loop->timers_done_data);
+	}
+
+	update_event_loop_timer(loop);
+	return 0;
+}
+
+void set_event_loop_timers_done(struct mako_event_loop *loop,
+		mako_event_loop_timer_func_t func, void *data) {
+	loop->timers_done_func = func;
+	loop->timers_done_data = data;
+}
+
+struct mako_idle *add_event_loop_idle(struct mako_event_loop *loop,
+		mako_event_loop_idle_func_t func, void *data) {
+	struct mako_idle *idle = calloc(1, sizeof(struct mako_idle));
+	if (idle == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return NULL;
+	}
+	idle->func = func;
+	idle->user_data = data;
+	wl_list_insert(loop->idles.prev, &idle->link);
+	return idle;
+}
+
+void destroy_idle(struct mako_idle *idle) {
+	if (idle == NULL) {
 		return;
 	}
+	wl_list_remove(&idle->link);
+	free(idle);
+}
 
-	struct mako_timer *timer = loop->next_timer;
-	if (timer == NULL) {
+static void dispatch_idles(struct mako_event_loop *loop) {
+	// Idles added from a callback run right away too
+	while (!wl_list_empty(&loop->idles)) {
+		struct mako_idle *idle =
+			wl_container_of(loop->idles.next, idle, link);
+		mako_event_loop_idle_func_t func = idle->func;
+		void *user_data = idle->user_data;
+		destroy_idle(idle);
+
+		func(user_data);
+	}
+}
+
+// Stops the event loop if a connection was closed by the other end.
+static int check_hangup(struct mako_event_loop *loop, uint32_t events,
+		const char *name) {
+	if (events & EPOLLHUP) {
+		loop->running = false;
+		return 0;
+	}
+	if (events & EPOLLERR) {
+		fprintf(stderr, "failed to poll %s socket\n", name);
+		return -1;
+	}
+	return 1;
+}
+
+static int handle_signal(int fd, uint32_t events, void *data) {
+	struct mako_event_loop *loop = data;
+	(void)fd;
+	(void)events;
+
+	loop->running = false;
+	return 0;
+}
+
+static int handle_dbus(int fd, uint32_t events, void *data) {
+	struct mako_event_loop *loop = data;
+	(void)fd;
+
+	int ret = check_hangup(loop, events, "D-Bus");
+	if (ret <= 0) {
+		return ret;
+	}
+
+	if (events & EPOLLIN) {
+		do {
+			ret = sd_bus_process(loop->bus, NULL);
+		} while (ret > 0);
+
+		if (ret < 0) {
+			fprintf(stderr, "failed to process D-Bus: %s\n", strerror(-ret));
+			return ret;
+		}
+	}
+	if (events & EPOLLOUT) {
+		ret = sd_bus_flush(loop->bus);
+		if (ret < 0) {
+			fprintf(stderr, "failed to flush D-Bus: %s\n", strerror(-ret));
+			return ret;
+		}
+	}
+	return 0;
+}
+
+// The events have already been read by run_event_loop(), see
+// wl_display_prepare_read().
+static int handle_wayland(int fd, uint32_t events, void *data) {
+	struct mako_event_loop *loop = data;
+	(void)fd;
+
+	int ret = check_hangup(loop, events, "Wayland");
+	if (ret <= 0) {
+		return ret;
+	}
+
+	if (events & EPOLLIN) {
+		ret = wl_display_dispatch_pending(loop->display);
+		if (ret < 0) {
+			fprintf(stderr, "failed to dispatch Wayland events\n");
+			return ret;
+		}
+	}
+	if (events & EPOLLOUT) {
+		ret = wl_display_flush(loop->display);
+		if (ret < 0 && errno != EAGAIN) {
+			fprintf(stderr, "failed to flush Wayland events\n");
+			return ret;
+		}
+		// Wait for the socket to be writable again if it's still full
+		update_event_source(loop->wayland_source,
+			EPOLLIN | (ret < 0 ? EPOLLOUT : 0));
+	}
+	return 0;
+}
+
+// Only asks for EPOLLOUT while there are outgoing messages which couldn't be
+// written, so that the loop doesn't spin on a writable socket.
+static void update_dbus_events(struct mako_event_loop *loop) {
+	int events = sd_bus_get_events(loop->bus);
+	if (events < 0) {
 		return;
 	}
+	update_event_source(loop->dbus_source,
+		EPOLLIN | (events & POLLOUT ? EPOLLOUT : 0));
+}
 
-	mako_event_loop_timer_func_t func = timer->func;
-	void *user_data = timer->user_data;
-	destroy_timer(timer);
+// Prepares the Wayland queue for reading, dispatching whatever is already
+// queued, and flushes the requests. Returns false on error.
+static bool prepare_wayland_read(struct mako_event_loop *loop) {
+	while (wl_display_prepare_read(loop->display) != 0) {
+		if (wl_display_dispatch_pending(loop->display) < 0) {
+			fprintf(stderr, "failed to dispatch pending Wayland events\n");
+			return false;
+		}
+	}
 
-	func(user_data);
+	errno = 0;
+	int ret = wl_display_flush(loop->display);
+	update_event_source(loop->wayland_source,
+		EPOLLIN | (ret < 0 && errno == EAGAIN ? EPOLLOUT : 0));
+	return true;
 }
 
 int run_event_loop(struct mako_event_loop *loop) {
@@ -194,90 +586,78 @@ int run_event_loop(struct mako_event_loop *loop) {
 		return ret;
 	}
 
+	struct epoll_event events[16];
 	while (loop->running) {
 		errno = 0;
 
+		// Run deferred work before flushing, so that its requests and
+		// messages are sent out with everything else.
+		dispatch_idles(loop);
+
 		// Wayland requests can be generated while handling non-Wayland events.
 		// We need to flush these.
-		do {
-			ret = wl_display_dispatch_pending(loop->display);
-			wl_display_flush(loop->display);
-		} while (ret > 0);
-
-		if (ret < 0) {
-			fprintf(stderr, "failed to dispatch pending Wayland events\n");
+		if (!prepare_wayland_read(loop)) {
+			ret = -1;
 			break;
 		}
 
 		// Same for D-Bus.
 		sd_bus_flush(loop->bus);
+		update_dbus_events(loop);
 
-		ret = poll(loop->fds, MAKO_EVENT_COUNT, -1);
+		int n = epoll_wait(loop->epoll_fd, events,
+			sizeof(events) / sizeof(events[0]), -1);
 		if (!loop->running) {
+			wl_display_cancel_read(loop->display);
 			ret = 0;
 			break;
 		}
-		if (ret < 0) {
-			fprintf(stderr, "failed to poll(): %s\n", strerror(errno));
-			break;
-		}
-
-		for (size_t i = 0; i < MAKO_EVENT_COUNT; ++i) {
-			if (loop->fds[i].revents & POLLHUP) {
-				loop->running = false;
-				break;
-			}
-			if (loop->fds[i].revents & POLLERR) {
-				fprintf(stderr, "failed to poll() socket %zu\n", i);
-				ret = -1;
-				break;
+		if (n < 0) {
+			wl_display_cancel_read(loop->display);
+			if (errno == EINTR) {
+				continue;
 			}
-		}
-		if (!loop->running || ret < 0) {
+			fprintf(stderr, "failed to epoll_wait(): %s\n", strerror(errno));
+			ret = -1;
 			break;
 		}
 
-		if (loop->fds[MAKO_EVENT_SIGNAL].revents & POLLIN) {
-			break;
-		}
-
-		if (loop->fds[MAKO_EVENT_DBUS].revents & POLLIN) {
-			do {
-				ret = sd_bus_process(loop->bus, NULL);
-			} while (ret > 0);
-
-			if (ret < 0) {
-				fprintf(stderr, "failed to process D-Bus: %s\n",
-					strerror(-ret));
+		// Read the Wayland events before any other source is dispatched,
+		// since this thread holds the read intent until then.
+		bool wayland_readable = false;
+		for (int i = 0; i < n; ++i) {
+			if (events[i].data.ptr == loop->wayland_source) {
+				wayland_readable = (events[i].events &
+					(EPOLLIN | EPOLLHUP | EPOLLERR)) == EPOLLIN;
 				break;
 			}
 		}
-		if (loop->fds[MAKO_EVENT_DBUS].revents & POLLOUT) {
-			ret = sd_bus_flush(loop->bus);
-			if (ret < 0) {
-				fprintf(stderr, "failed to flush D-Bus: %s\n",
-					strerror(-ret));
+		if (wayland_readable) {
+			if (wl_display_read_events(loop->display) < 0) {
+				fprintf(stderr, "failed to read Wayland events\n");
+				ret = -1;
 				break;
 			}
+		} else {
+			wl_display_cancel_read(loop->display);
 		}
 
-		if (loop->fds[MAKO_EVENT_WAYLAND].revents & POLLIN) {
-			ret = wl_display_dispatch(loop->display);
-			if (ret < 0) {
-				fprintf(stderr, "failed to read Wayland events\n");
-				break;
+		ret = 0;
+		for (int i = 0; i < n && loop->running; ++i) {
+			struct mako_event_source *source = events[i].data.ptr;
+			if (source->fd < 0) {
+				// Destroyed by a previous callback
+				continue;
 			}
-		}
-		if (loop->fds[MAKO_EVENT_WAYLAND].revents & POLLOUT) {
-			ret = wl_display_flush(loop->display);
+			ret = source->func(source->fd, events[i].events,
+				source->user_data);
 			if (ret < 0) {
-				fprintf(stderr, "failed to flush Wayland events\n");
 				break;
 			}
 		}
-
-		if (loop->fds[MAKO_EVENT_TIMER].revents & POLLIN) {
-			handle_event_loop_timer(loop);
+		free_sources(&loop->destroyed_sources);
+		if (ret < 0) {
+			break;
 		}
 	}
 	return ret;
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash-table.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// Marks slots whose entry has been removed, so that probing continues past
+// them.
+static char tombstone;
+
+uint64_t hash_bytes_update(uint64_t hash, const void *data, size_t len) {
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+uint64_t hash_bytes(const void *data, size_t len) {
+	return hash_bytes_update(FNV_OFFSET_BASIS, data, len);
+}
+
+void hash_table_init(struct mako_hash_table *table) {
+	memset(table, 0, sizeof(*table));
+}
+
+void hash_table_finish(struct mako_hash_table *table) {
+	for (size_t i = 0; i < table->capacity; ++i) {
+		struct mako_hash_entry *entry = &table->entries[i];
+		if (entry->key != NULL && entry->key != &tombstone) {
+			free(entry->key);
+		}
+	}
+	free(table->entries);
+	hash_table_init(table);
+}
+
+static struct mako_hash_entry *find_entry(const struct mako_hash_table *table,
+		uint64_t hash, const void *key, size_t key_len) {
+	if (table->capacity == 0) {
+		return NULL;
+	}
+
+	size_t mask = table->capacity - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		struct mako_hash_entry *entry = &table->entries[i];
+		if (entry->key == NULL) {
+			return NULL;
+		}
+		if (entry->key != &tombstone && entry->hash == hash &&
+				entry->key_len == key_len &&
+				memcmp(entry->key, key, key_len) == 0) {
+			return entry;
+		}
+	}
+}
+
+static void insert_entry(struct mako_hash_table *table,
+		struct mako_hash_entry *src) {
+	size_t mask = table->capacity - 1;
+	for (size_t i = src->hash & mask;; i = (i + 1) & mask) {
+		struct mako_hash_entry *entry = &table->entries[i];
+		if (entry->key == NULL || entry->key == &tombstone) {
+			if (entry->key == &tombstone) {
+				--table->tombstones;
+			}
+			*entry = *src;
+			++table->len;
+			return;
+		}
+	}
+}
+
+static bool resize(struct mako_hash_table *table, size_t capacity) {
+	struct mako_hash_entry *entries =
+		calloc(capacity, sizeof(struct mako_hash_entry));
+	if (entries == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
+
+	struct mako_hash_entry *old_entries = table->entries;
+	size_t old_capacity = table->capacity;
+
+	table->entries = entries;
+	table->capacity = capacity;
+	table->len = 0;
+	table->tombstones = 0;
+
+	for (size_t i = 0; i < old_capacity; ++i) {
+		struct mako_hash_entry *entry = &old_entries[i];
+		if (entry->key != NULL && entry->key != &tombstone) {
+			insert_entry(table, entry);
+		}
+	}
+
+	free(old_entries);
+	return true;
+}
+
+void *hash_table_get(const struct mako_hash_table *table,
+		const void *key, size_t key_len) {
+	struct mako_hash_entry *entry =
+		find_entry(table, hash_bytes(key, key_len), key, key_len);
+	return entry ? entry->value : NULL;
+}
+
+bool hash_table_set(struct mako_hash_table *table,
+		const void *key, size_t key_len, void *value) {
+	uint64_t hash = hash_bytes(key, key_len);
+	struct mako_hash_entry *existing = find_entry(table, hash, key, key_len);
+	if (existing != NULL) {
+		existing->value = value;
+		return true;
+	}
+
+	// Keep the load factor (including tombstones) under 3/4.
+	if ((table->len + table->tombstones + 1) * 4 > table->capacity * 3) {
+		size_t capacity = table->capacity ? table->capacity : 8;
+		while ((table->len + 1) * 2 > capacity) {
+			capacity *= 2;
+		}
+		if (!resize(table, capacity)) {
+			return false;
+		}
+	}
+
+	// Allocate at least one byte so that empty keys aren't confused with
+	// empty slots.
+	void *key_copy = malloc(key_len ? key_len : 1);
+	if (key_copy == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
+	memcpy(key_copy, key, key_len);
+
+	struct mako_hash_entry entry = {
+		.hash = hash,
+		.key = key_copy,
+		.key_len = key_len,
+		.value = value,
+	};
+	insert_entry(table, &entry);
+	return true;
+}
+
+void *hash_table_remove(struct mako_hash_table *table,
+		const void *key, size_t key_len) {
+	struct mako_hash_entry *entry =
+		find_entry(table, hash_bytes(key, key_len), key, key_len);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	void *value = entry->value;
+	free(entry->key);
+	entry->key = &tombstone;
+	entry->key_len = 0;
+	entry->value = NULL;
+	--table->len;
+	++table->tombstones;
+	return value;
+}
+
+struct mako_hash_entry *hash_table_next(const struct mako_hash_table *table,
+		size_t *iter) {
+	while (*iter < table->capacity) {
+		struct mako_hash_entry *entry = &table->entries[(*iter)++];
+		if (entry->key != NULL && entry->key != &tombstone) {
+			return entry;
+		}
+	}
+	return NULL;
+}
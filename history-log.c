@@ -0,0 +1,667 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history-log.h"
+#include "string-util.h"
+
+#define HISTORY_LOG_VERSION 1
+
+static const char log_magic[] = "MAKOHLOG";
+static const char index_magic[] = "MAKOHIDX";
+
+struct history_file_header {
+	char magic[8];
+	uint32_t version;
+	// Bumped in both files by every compaction. Readers only use an index
+	// with the same generation as the log: since the files are replaced one
+	// after the other, the offsets in the index could otherwise point into
+	// the middle of records.
+	uint32_t generation;
+};
+
+// Fixed-size part of a record, after its length
+struct history_record_header {
+	uint32_t id;
+	uint32_t urgency;
+	int32_t requested_timeout;
+	int32_t progress;
+	int64_t closed_at_sec;
+	int64_t closed_at_nsec;
+	uint32_t actions_len;
+	uint32_t reserved;
+};
+
+char *get_history_log_dir(void) {
+	const char *state_home = getenv("XDG_STATE_HOME");
+	if (state_home != NULL && state_home[0] != '\0') {
+		return mako_asprintf("%s/mako", state_home);
+	}
+
+	const char *home = getenv("HOME");
+	if (home == NULL) {
+		fprintf(stderr, "HOME env var not set\n");
+		return NULL;
+	}
+	return mako_asprintf("%s/.local/state/mako", home);
+}
+
+const char *next_history_record_string(const char *str) {
+	return str + strlen(str) + 1;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+	const uint8_t *p = data;
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool write_header(int fd, const char magic[static 8],
+		uint32_t generation) {
+	struct history_file_header header = {
+		.version = HISTORY_LOG_VERSION,
+		.generation = generation,
+	};
+	memcpy(header.magic, magic, sizeof(header.magic));
+	return write_all(fd, &header, sizeof(header));
+}
+
+static bool check_header(const uint8_t *data, size_t size,
+		const char magic[static 8], uint32_t *generation) {
+	struct history_file_header header;
+	if (size < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+	*generation = header.generation;
+	return memcmp(header.magic, magic, sizeof(header.magic)) == 0 &&
+		header.version == HISTORY_LOG_VERSION;
+}
+
+// Like mkdir -p
+static bool make_dirs(const char *path) {
+	char *copy = strdup(path);
+	if (copy == NULL) {
+		return false;
+	}
+	for (char *p = copy + 1; ; ++p) {
+		if (*p != '/' && *p != '\0') {
+			continue;
+		}
+		char c = *p;
+		*p = '\0';
+		if (mkdir(copy, 0700) != 0 && errno != EEXIST) {
+			fprintf(stderr, "Failed to create %s: %s\n", copy, strerror(errno));
+			free(copy);
+			return false;
+		}
+		*p = c;
+		if (c == '\0') {
+			break;
+		}
+	}
+	free(copy);
+	return true;
+}
+
+static bool map_file(int fd, const uint8_t **data, size_t *size) {
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		return false;
+	}
+	*size = st.st_size;
+	if (*size == 0) {
+		*data = NULL;
+		return true;
+	}
+	void *map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		return false;
+	}
+	*data = map;
+	return true;
+}
+
+static void unmap_file(const uint8_t *data, size_t size) {
+	if (data != NULL) {
+		munmap((void *)data, size);
+	}
+}
+
+// Walks the chain of record lengths. Returns the number of complete records,
+// and stores their offsets if `offsets` isn't NULL. `end` is set to the end
+// of the last complete record.
+static size_t scan_records(const uint8_t *log, size_t log_size,
+		uint64_t *offsets, uint64_t *end) {
+	size_t len = 0;
+	uint64_t offset = sizeof(struct history_file_header);
+	while (log_size - offset >= sizeof(uint32_t)) {
+		uint32_t record_size;
+		memcpy(&record_size, log + offset, sizeof(record_size));
+		if (record_size > log_size - offset - sizeof(uint32_t)) {
+			break; // Torn write
+		}
+		if (offsets != NULL) {
+			offsets[len] = offset;
+		}
+		++len;
+		offset += sizeof(uint32_t) + record_size;
+	}
+	*end = offset;
+	return len;
+}
+
+// Writes `data` to a temporary file next to `path`, then moves it over `path`.
+static bool replace_file(const char *path, const char magic[static 8],
+		uint32_t generation, const void *data, size_t size) {
+	char *tmp_path = mako_asprintf("%s.tmp", path);
+	if (tmp_path == NULL) {
+		return false;
+	}
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to create %s: %s\n", tmp_path, strerror(errno));
+		free(tmp_path);
+		return false;
+	}
+	bool ok = write_header(fd, magic, generation) && write_all(fd, data, size) &&
+		fsync(fd) == 0;
+	close(fd);
+	if (ok && rename(tmp_path, path) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+		unlink(tmp_path);
+	}
+	free(tmp_path);
+	return ok;
+}
+
+static bool open_files(struct mako_history_log *log) {
+	log->log_fd = open(log->log_path,
+		O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (log->log_fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", log->log_path,
+			strerror(errno));
+		return false;
+	}
+	log->index_fd = open(log->index_path,
+		O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (log->index_fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", log->index_path,
+			strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static void close_files(struct mako_history_log *log) {
+	if (log->log_fd >= 0) {
+		close(log->log_fd);
+	}
+	if (log->index_fd >= 0) {
+		close(log->index_fd);
+	}
+	log->log_fd = log->index_fd = -1;
+}
+
+// Makes sure the log ends with a complete record and that the index matches
+// it, in case mako was stopped in the middle of an append or a compaction.
+static bool recover_history_log(struct mako_history_log *log) {
+	const uint8_t *data;
+	size_t size;
+	if (!map_file(log->log_fd, &data, &size)) {
+		return false;
+	}
+
+	log->generation = 0;
+	if (size == 0) {
+		if (!write_header(log->log_fd, log_magic, log->generation)) {
+			return false;
+		}
+		size = sizeof(struct history_file_header);
+	} else if (!check_header(data, size, log_magic, &log->generation)) {
+		fprintf(stderr, "%s is not a mako history log\n", log->log_path);
+		unmap_file(data, size);
+		return false;
+	}
+
+	uint64_t end;
+	size_t len = data != NULL ? scan_records(data, size, NULL, &end) : 0;
+	uint64_t *offsets = calloc(len + 1, sizeof(uint64_t));
+	if (offsets == NULL) {
+		unmap_file(data, size);
+		return false;
+	}
+	if (data != NULL) {
+		scan_records(data, size, offsets, &end);
+	} else {
+		end = size;
+	}
+	unmap_file(data, size);
+
+	bool ok = true;
+	if (end < size) {
+		fprintf(stderr, "Dropping incomplete record at the end of %s\n",
+			log->log_path);
+		ok = ftruncate(log->log_fd, end) == 0;
+	}
+
+	const uint8_t *index;
+	size_t index_size;
+	if (ok && map_file(log->index_fd, &index, &index_size)) {
+		size_t offsets_size = len * sizeof(uint64_t);
+		uint32_t generation;
+		bool up_to_date = index_size ==
+				sizeof(struct history_file_header) + offsets_size &&
+			check_header(index, index_size, index_magic, &generation) &&
+			generation == log->generation &&
+			memcmp(index + sizeof(struct history_file_header), offsets,
+				offsets_size) == 0;
+		unmap_file(index, index_size);
+
+		if (!up_to_date) {
+			ok = replace_file(log->index_path, index_magic, log->generation,
+				offsets, offsets_size);
+			close(log->index_fd);
+			log->index_fd = open(log->index_path,
+				O_RDWR | O_APPEND | O_CLOEXEC);
+			ok = ok && log->index_fd >= 0;
+		}
+	} else {
+		ok = false;
+	}
+
+	free(offsets);
+	log->log_size = end;
+	log->len = len;
+	return ok;
+}
+
+struct mako_history_log *open_history_log(const char *dir, size_t max_len) {
+	if (!make_dirs(dir)) {
+		return NULL;
+	}
+
+	struct mako_history_log *log = calloc(1, sizeof(struct mako_history_log));
+	if (log == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return NULL;
+	}
+	log->log_fd = log->index_fd = -1;
+	log->max_len = max_len;
+	log->log_path = mako_asprintf("%s/history.log", dir);
+	log->index_path = mako_asprintf("%s/history.idx", dir);
+	if (log->log_path == NULL || log->index_path == NULL ||
+			!open_files(log) || !recover_history_log(log)) {
+		fprintf(stderr, "Failed to open the persistent history in %s\n", dir);
+		close_history_log(log);
+		return NULL;
+	}
+	return log;
+}
+
+void close_history_log(struct mako_history_log *log) {
+	if (log == NULL) {
+		return;
+	}
+	close_files(log);
+	free(log->log_path);
+	free(log->index_path);
+	free(log);
+}
+
+// Only keeps the max_len most recent records. They're at the end of the log,
+// so it's a matter of copying its tail.
+static bool compact_history_log(struct mako_history_log *log) {
+	size_t dropped = log->len - log->max_len;
+	uint64_t start;
+	ssize_t n = pread(log->index_fd, &start, sizeof(start),
+		sizeof(struct history_file_header) + dropped * sizeof(uint64_t));
+	if (n != (ssize_t)sizeof(start) || start > log->log_size) {
+		return false;
+	}
+
+	size_t offsets_size = log->max_len * sizeof(uint64_t);
+	uint64_t *offsets = malloc(offsets_size > 0 ? offsets_size : 1);
+	if (offsets == NULL) {
+		return false;
+	}
+	n = pread(log->index_fd, offsets, offsets_size,
+		sizeof(struct history_file_header) + dropped * sizeof(uint64_t));
+	if (n < 0 || (size_t)n != offsets_size) {
+		free(offsets);
+		return false;
+	}
+	uint64_t shift = start - sizeof(struct history_file_header);
+	for (size_t i = 0; i < log->max_len; ++i) {
+		offsets[i] -= shift;
+	}
+
+	const uint8_t *data;
+	size_t size;
+	if (!map_file(log->log_fd, &data, &size) || size < log->log_size) {
+		free(offsets);
+		return false;
+	}
+
+	// The log is replaced first: if mako stops in between, the index is
+	// rebuilt on startup.
+	uint32_t generation = log->generation + 1;
+	bool ok = replace_file(log->log_path, log_magic, generation, data + start,
+			log->log_size - start) &&
+		replace_file(log->index_path, index_magic, generation, offsets,
+			offsets_size);
+	unmap_file(data, size);
+	free(offsets);
+	if (!ok) {
+		return false;
+	}
+
+	close_files(log);
+	if (!open_files(log)) {
+		return false;
+	}
+	log->log_size -= shift;
+	log->len = log->max_len;
+	log->generation = generation;
+	return true;
+}
+
+// Called when a previous write failed and closed the files. The log is checked
+// again and the index rebuilt, so that a transient error such as ENOSPC only
+// loses the records which couldn't be written.
+static bool reopen_history_log(struct mako_history_log *log) {
+	close_files(log);
+	if (!open_files(log) || !recover_history_log(log)) {
+		close_files(log);
+		return false;
+	}
+	return true;
+}
+
+static size_t string_size(const char *str) {
+	return strlen(str != NULL ? str : "") + 1;
+}
+
+static uint8_t *append_string(uint8_t *p, const char *str, size_t size) {
+	memcpy(p, str != NULL ? str : "", size);
+	return p + size;
+}
+
+bool append_history_log(struct mako_history_log *log,
+		const struct mako_history_record *record) {
+	if ((log->log_fd < 0 || log->index_fd < 0) && !reopen_history_log(log)) {
+		return false;
+	}
+
+	const char *strings[] = {
+		record->app_name,
+		record->app_icon,
+		record->summary,
+		record->body,
+		record->category,
+		record->desktop_entry,
+		record->tag,
+	};
+	size_t n_strings = sizeof(strings) / sizeof(strings[0]);
+
+	size_t actions_size = 0;
+	const char *action = record->actions;
+	for (size_t i = 0; i < 2 * record->actions_len; ++i) {
+		action = next_history_record_string(action);
+	}
+	if (record->actions_len > 0) {
+		actions_size = action - record->actions;
+	}
+
+	size_t record_size = sizeof(struct history_record_header) + actions_size;
+	for (size_t i = 0; i < n_strings; ++i) {
+		record_size += string_size(strings[i]);
+	}
+	if (record_size > UINT32_MAX) {
+		return false;
+	}
+
+	uint8_t *buf = malloc(sizeof(uint32_t) + record_size);
+	if (buf == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
+
+	uint32_t size32 = record_size;
+	struct history_record_header header = {
+		.id = record->id,
+		.urgency = record->urgency,
+		.requested_timeout = record->requested_timeout,
+		.progress = record->progress,
+		.closed_at_sec = record->closed_at.tv_sec,
+		.closed_at_nsec = record->closed_at.tv_nsec,
+		.actions_len = record->actions_len,
+	};
+	uint8_t *p = buf;
+	memcpy(p, &size32, sizeof(size32));
+	p += sizeof(size32);
+	memcpy(p, &header, sizeof(header));
+	p += sizeof(header);
+	for (size_t i = 0; i < n_strings; ++i) {
+		p = append_string(p, strings[i], string_size(strings[i]));
+	}
+	if (actions_size > 0) {
+		memcpy(p, record->actions, actions_size);
+	}
+
+	uint64_t offset = log->log_size;
+	bool ok = write_all(log->log_fd, buf, sizeof(uint32_t) + record_size);
+	free(buf);
+	if (!ok) {
+		fprintf(stderr, "Failed to write to %s: %s\n", log->log_path,
+			strerror(errno));
+		// Don't leave a partial record behind, or have the next append
+		// drop it when reopening the log
+		if (ftruncate(log->log_fd, log->log_size) != 0) {
+			close_files(log);
+		}
+		return false;
+	}
+	log->log_size += sizeof(uint32_t) + record_size;
+	++log->len;
+
+	if (!write_all(log->index_fd, &offset, sizeof(offset))) {
+		// The next append reopens the files, which rebuilds the index
+		fprintf(stderr, "Failed to write to %s: %s\n", log->index_path,
+			strerror(errno));
+		close_files(log);
+		return false;
+	}
+
+	// Let the log grow a bit past the limit, so that compaction only
+	// happens once in a while
+	if (log->max_len > 0 && log->len > log->max_len + log->max_len / 2) {
+		if (!compact_history_log(log)) {
+			// The next append reopens the files and tries again
+			fprintf(stderr, "Failed to compact %s\n", log->log_path);
+			close_files(log);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool check_index(const struct mako_history_log_reader *reader,
+		uint32_t log_generation) {
+	uint32_t generation;
+	if (reader->index == NULL ||
+			!check_header(reader->index, reader->index_size, index_magic,
+				&generation) ||
+			generation != log_generation ||
+			(reader->index_size - sizeof(struct history_file_header)) %
+				sizeof(uint64_t) != 0) {
+		return false;
+	}
+	size_t len = (reader->index_size - sizeof(struct history_file_header)) /
+		sizeof(uint64_t);
+	const uint64_t *offsets = (const uint64_t *)(reader->index +
+		sizeof(struct history_file_header));
+	// Records may have been appended to either file after the log was mapped
+	return len == 0 || offsets[len - 1] < reader->log_size;
+}
+
+bool open_history_log_reader(struct mako_history_log_reader *reader,
+		const char *dir) {
+	memset(reader, 0, sizeof(*reader));
+
+	char *log_path = mako_asprintf("%s/history.log", dir);
+	char *index_path = mako_asprintf("%s/history.idx", dir);
+	if (log_path == NULL || index_path == NULL) {
+		free(log_path);
+		free(index_path);
+		return false;
+	}
+
+	bool ok = false;
+	int log_fd = open(log_path, O_RDONLY | O_CLOEXEC);
+	if (log_fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", log_path, strerror(errno));
+		goto out;
+	}
+	ok = map_file(log_fd, &reader->log, &reader->log_size);
+	close(log_fd);
+	uint32_t generation;
+	if (!ok || !check_header(reader->log, reader->log_size, log_magic,
+			&generation)) {
+		fprintf(stderr, "%s is not a mako history log\n", log_path);
+		ok = false;
+		goto out;
+	}
+
+	int index_fd = open(index_path, O_RDONLY | O_CLOEXEC);
+	if (index_fd >= 0) {
+		if (!map_file(index_fd, &reader->index, &reader->index_size)) {
+			reader->index = NULL;
+		}
+		close(index_fd);
+	}
+
+	if (check_index(reader, generation)) {
+		reader->offsets = (const uint64_t *)(reader->index +
+			sizeof(struct history_file_header));
+		reader->len = (reader->index_size -
+			sizeof(struct history_file_header)) / sizeof(uint64_t);
+	} else {
+		// Fall back to walking the log
+		uint64_t end;
+		size_t len = scan_records(reader->log, reader->log_size, NULL, &end);
+		reader->rebuilt_offsets = calloc(len + 1, sizeof(uint64_t));
+		if (reader->rebuilt_offsets == NULL) {
+			ok = false;
+			goto out;
+		}
+		scan_records(reader->log, reader->log_size, reader->rebuilt_offsets,
+			&end);
+		reader->offsets = reader->rebuilt_offsets;
+		reader->len = len;
+	}
+
+out:
+	if (!ok) {
+		close_history_log_reader(reader);
+	}
+	free(log_path);
+	free(index_path);
+	return ok;
+}
+
+void close_history_log_reader(struct mako_history_log_reader *reader) {
+	unmap_file(reader->log, reader->log_size);
+	unmap_file(reader->index, reader->index_size);
+	free(reader->rebuilt_offsets);
+	memset(reader, 0, sizeof(*reader));
+}
+
+// Returns the string at *p and moves past it, or NULL if it isn't terminated
+// before end.
+static const char *read_string(const uint8_t **p, const uint8_t *end) {
+	const uint8_t *nul = memchr(*p, '\0', end - *p);
+	if (nul == NULL) {
+		return NULL;
+	}
+	const char *str = (const char *)*p;
+	*p = nul + 1;
+	return str;
+}
+
+bool read_history_log_record(const struct mako_history_log_reader *reader,
+		size_t i, struct mako_history_record *record) {
+	if (i >= reader->len) {
+		return false;
+	}
+
+	uint64_t offset = reader->offsets[i];
+	uint32_t record_size;
+	struct history_record_header header;
+	if (offset < sizeof(struct history_file_header) ||
+			offset > reader->log_size ||
+			reader->log_size - offset < sizeof(record_size)) {
+		return false;
+	}
+	memcpy(&record_size, reader->log + offset, sizeof(record_size));
+	offset += sizeof(record_size);
+	if (record_size > reader->log_size - offset ||
+			record_size < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, reader->log + offset, sizeof(header));
+
+	const uint8_t *p = reader->log + offset + sizeof(header);
+	const uint8_t *end = reader->log + offset + record_size;
+	*record = (struct mako_history_record){
+		.id = header.id,
+		.urgency = header.urgency,
+		.requested_timeout = header.requested_timeout,
+		.progress = header.progress,
+		.closed_at = {
+			.tv_sec = header.closed_at_sec,
+			.tv_nsec = header.closed_at_nsec,
+		},
+		.actions_len = header.actions_len,
+	};
+	const char **strings[] = {
+		&record->app_name,
+		&record->app_icon,
+		&record->summary,
+		&record->body,
+		&record->category,
+		&record->desktop_entry,
+		&record->tag,
+	};
+	for (size_t j = 0; j < sizeof(strings) / sizeof(strings[0]); ++j) {
+		*strings[j] = read_string(&p, end);
+		if (*strings[j] == NULL) {
+			return false;
+		}
+	}
+
+	record->actions = (const char *)p;
+	for (size_t j = 0; j < 2 * record->actions_len; ++j) {
+		if (read_string(&p, end) == NULL) {
+			return false;
+		}
+	}
+	return true;
+}
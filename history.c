@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+#include "history-log.h"
+#include "mako.h"
+#include "notification.h"
+
+void init_history(struct mako_history *history) {
+	memset(history, 0, sizeof(*history));
+}
+
+static void finish_history_entry(struct mako_history_entry *entry) {
+	free(entry->app_name);
+	free(entry->app_icon);
+	free(entry->summary);
+	free(entry->body);
+	free(entry->category);
+	free(entry->desktop_entry);
+	free(entry->tag);
+	for (size_t i = 0; i < entry->actions_len; ++i) {
+		free(entry->actions[i].key);
+		free(entry->actions[i].title);
+	}
+	free(entry->actions);
+	memset(entry, 0, sizeof(*entry));
+}
+
+static struct mako_history_entry *get_slot(struct mako_history *history,
+		size_t i) {
+	return &history->entries[(history->start + i) % history->capacity];
+}
+
+void finish_history(struct mako_history *history) {
+	for (size_t i = 0; i < history->len; ++i) {
+		finish_history_entry(get_slot(history, i));
+	}
+	free(history->entries);
+	init_history(history);
+}
+
+// Changes the capacity, keeping the most recent entries.
+static bool resize_history(struct mako_history *history, size_t capacity) {
+	struct mako_history_entry *entries = NULL;
+	if (capacity > 0) {
+		entries = calloc(capacity, sizeof(struct mako_history_entry));
+		if (entries == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			return false;
+		}
+	}
+
+	size_t dropped = history->len > capacity ? history->len - capacity : 0;
+	for (size_t i = 0; i < history->len; ++i) {
+		struct mako_history_entry *entry = get_slot(history, i);
+		if (i < dropped) {
+			finish_history_entry(entry);
+		} else {
+			entries[i - dropped] = *entry;
+		}
+	}
+
+	free(history->entries);
+	history->entries = entries;
+	history->capacity = capacity;
+	history->start = 0;
+	history->len -= dropped;
+	return true;
+}
+
+static bool freeze_notification(struct mako_history_entry *entry,
+		const struct mako_notification *notif) {
+	entry->id = notif->id;
+	entry->urgency = notif->urgency;
+	entry->requested_timeout = notif->requested_timeout;
+	entry->progress = notif->progress;
+	clock_gettime(CLOCK_REALTIME, &entry->closed_at);
+
+	entry->app_name = strdup(notif->app_name);
+	entry->app_icon = strdup(notif->app_icon);
+	entry->summary = strdup(notif->summary);
+	entry->body = strdup(notif->body);
+	entry->category = strdup(notif->category);
+	entry->desktop_entry = strdup(notif->desktop_entry);
+	entry->tag = strdup(notif->tag);
+	if (entry->app_name == NULL || entry->app_icon == NULL ||
+			entry->summary == NULL || entry->body == NULL ||
+			entry->category == NULL || entry->desktop_entry == NULL ||
+			entry->tag == NULL) {
+		return false;
+	}
+
+	size_t actions_len = wl_list_length(&notif->actions);
+	if (actions_len == 0) {
+		return true;
+	}
+	entry->actions = calloc(actions_len, sizeof(struct mako_history_action));
+	if (entry->actions == NULL) {
+		return false;
+	}
+	// The action list is kept in reverse order, see handle_notify()
+	struct mako_action *action;
+	wl_list_for_each(action, &notif->actions, link) {
+		struct mako_history_action *frozen = &entry->actions[entry->actions_len];
+		frozen->key = strdup(action->key);
+		frozen->title = strdup(action->title);
+		++entry->actions_len;
+		if (frozen->key == NULL || frozen->title == NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool push_history(struct mako_history *history, size_t max_len,
+		const struct mako_notification *notif) {
+	if (history->capacity != max_len && !resize_history(history, max_len)) {
+		return false;
+	}
+	if (history->capacity == 0) {
+		return true;
+	}
+
+	struct mako_history_entry *entry;
+	if (history->len == history->capacity) {
+		// Evict the oldest entry
+		entry = get_slot(history, 0);
+		finish_history_entry(entry);
+		history->start = (history->start + 1) % history->capacity;
+	} else {
+		entry = get_slot(history, history->len);
+		++history->len;
+	}
+
+	if (!freeze_notification(entry, notif)) {
+		fprintf(stderr, "allocation failed\n");
+		finish_history_entry(entry);
+		--history->len;
+		return false;
+	}
+	return true;
+}
+
+struct mako_history_entry *get_history_entry(struct mako_history *history,
+		size_t n) {
+	if (n >= history->len) {
+		return NULL;
+	}
+	return get_slot(history, history->len - 1 - n);
+}
+
+struct mako_notification *restore_history(struct mako_state *state) {
+	struct mako_history *history = &state->history;
+	struct mako_history_entry *entry = get_history_entry(history, 0);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	struct mako_notification *notif = create_notification(state);
+	if (notif == NULL) {
+		return NULL;
+	}
+
+	// Hand the strings over to the notification
+	notif->id = entry->id;
+	notif->urgency = entry->urgency;
+	notif->requested_timeout = entry->requested_timeout;
+	notif->progress = entry->progress;
+#define MOVE_STRING(field) \
+	free(notif->field); \
+	notif->field = entry->field; \
+	entry->field = NULL;
+	MOVE_STRING(app_name);
+	MOVE_STRING(app_icon);
+	MOVE_STRING(summary);
+	MOVE_STRING(body);
+	MOVE_STRING(category);
+	MOVE_STRING(desktop_entry);
+	MOVE_STRING(tag);
+#undef MOVE_STRING
+
+	// Preserve the order of the action list
+	for (size_t i = entry->actions_len; i > 0; --i) {
+		struct mako_history_action *frozen = &entry->actions[i - 1];
+		struct mako_action *action = calloc(1, sizeof(struct mako_action));
+		if (action == NULL) {
+			break;
+		}
+		action->notification = notif;
+		action->key = frozen->key;
+		action->title = frozen->title;
+		frozen->key = frozen->title = NULL;
+		wl_list_insert(&notif->actions, &action->link);
+	}
+
+	finish_history_entry(entry);
+	--history->len;
+	return notif;
+}
+
+static bool log_history(struct mako_history_log *log,
+		const struct mako_notification *notif) {
+	// Same order as in the in-memory history, see freeze_notification()
+	size_t actions_size = 0, actions_len = 0;
+	struct mako_action *action;
+	wl_list_for_each(action, &notif->actions, link) {
+		actions_size += strlen(action->key) + 1 + strlen(action->title) + 1;
+		++actions_len;
+	}
+
+	char *actions = NULL;
+	if (actions_len > 0) {
+		actions = malloc(actions_size);
+		if (actions == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			return false;
+		}
+		char *p = actions;
+		wl_list_for_each(action, &notif->actions, link) {
+			p = stpcpy(p, action->key) + 1;
+			p = stpcpy(p, action->title) + 1;
+		}
+	}
+
+	struct mako_history_record record = {
+		.id = notif->id,
+		.urgency = notif->urgency,
+		.requested_timeout = notif->requested_timeout,
+		.progress = notif->progress,
+		.app_name = notif->app_name,
+		.app_icon = notif->app_icon,
+		.summary = notif->summary,
+		.body = notif->body,
+		.category = notif->category,
+		.desktop_entry = notif->desktop_entry,
+		.tag = notif->tag,
+		.actions = actions,
+		.actions_len = actions_len,
+	};
+	clock_gettime(CLOCK_REALTIME, &record.closed_at);
+
+	bool ok = append_history_log(log, &record);
+	free(actions);
+	return ok;
+}
+
+void record_history(struct mako_state *state,
+		const struct mako_notification *notif) {
+	if (state->config.max_history > 0) {
+		push_history(&state->history, state->config.max_history, notif);
+	}
+	if (state->history_log != NULL) {
+		log_history(state->history_log, notif);
+	}
+}
+
+void update_history_log(struct mako_state *state) {
+	struct mako_config *config = &state->config;
+	if (!config->persistent_history) {
+		close_history_log(state->history_log);
+		state->history_log = NULL;
+		return;
+	}
+
+	if (state->history_log != NULL) {
+		state->history_log->max_len = config->max_persistent_history;
+		return;
+	}
+
+	char *dir = get_history_log_dir();
+	if (dir == NULL) {
+		return;
+	}
+	state->history_log = open_history_log(dir, config->max_persistent_history);
+	free(dir);
+}
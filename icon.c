@@ -1,14 +1,17 @@
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fnmatch.h>
-#include <glob.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <cairo/cairo.h>
 
+#include "hash-table.h"
 #include "mako.h"
 #include "icon.h"
 #include "string-util.h"
@@ -54,17 +57,6 @@ static GdkPixbuf *load_image(const char *path) {
 	return pixbuf;
 }
 
-static GdkPixbuf *load_image_data(struct mako_image_data *image_data) {
-	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_data(image_data->data, GDK_COLORSPACE_RGB,
-			image_data->has_alpha, image_data->bits_per_sample, image_data->width,
-			image_data->height, image_data->rowstride, NULL, NULL);
-	if (!pixbuf) {
-		fprintf(stderr, "Failed to load icon\n");
-		return NULL;
-	}
-	return pixbuf;
-}
-
 static double fit_to_square(int width, int height, int square_size) {
 	double longest = width > height ? width : height;
 	return longest > square_size ? square_size/longest : 1.0;
@@ -94,6 +86,316 @@ static void url_decode(char *dst, const char *src) {
 	dst[0] = '\0';
 }
 
+static int32_t get_max_scale(struct mako_state *state) {
+	int32_t max_scale = 1;
+	struct mako_output *output = NULL;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (output->scale > max_scale) {
+			max_scale = output->scale;
+		}
+	}
+	return max_scale;
+}
+
+// How often, in seconds, icon directories are checked for modifications.
+#define ICON_DIR_CHECK_INTERVAL 5
+
+// An icon file found while indexing a directory.
+struct mako_icon_file {
+	int32_t size; // Zero for unsized directories
+	int32_t scale;
+	char *path;
+};
+
+// The modification time of a directory at the time it was indexed.
+struct mako_icon_dir_stamp {
+	char *path;
+	bool exists;
+	struct timespec mtime;
+};
+
+// Index of all icon files in a directory. Sized directories are icon themes,
+// with files in `<size>/<category>/` (or `<category>/<size>/`)
+// subdirectories. Unsized directories hold icon files directly, like
+// /usr/share/pixmaps.
+struct mako_icon_dir {
+	char *path;
+	bool sized;
+	struct mako_hash_table icons; // icon name -> struct wl_array of mako_icon_file
+	struct wl_array stamps; // struct mako_icon_dir_stamp
+	struct timespec checked_at;
+};
+
+static void add_dir_stamp(struct mako_icon_dir *dir, const char *path) {
+	struct mako_icon_dir_stamp *stamp =
+		wl_array_add(&dir->stamps, sizeof(*stamp));
+	if (stamp == NULL) {
+		return;
+	}
+
+	struct stat st;
+	stamp->path = strdup(path);
+	stamp->exists = stat(path, &st) == 0;
+	if (stamp->exists) {
+		stamp->mtime = st.st_mtim;
+	} else {
+		stamp->mtime = (struct timespec){0};
+	}
+}
+
+static bool icon_dir_changed(struct mako_icon_dir *dir) {
+	struct mako_icon_dir_stamp *stamp;
+	wl_array_for_each(stamp, &dir->stamps) {
+		struct stat st;
+		bool exists = stat(stamp->path, &st) == 0;
+		if (exists != stamp->exists) {
+			return true;
+		}
+		if (exists && (st.st_mtim.tv_sec != stamp->mtime.tv_sec ||
+				st.st_mtim.tv_nsec != stamp->mtime.tv_nsec)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void add_icon_file(struct mako_icon_dir *dir, const char *name,
+		size_t name_len, const char *path, int32_t size, int32_t scale) {
+	struct wl_array *files = hash_table_get(&dir->icons, name, name_len);
+	if (files == NULL) {
+		files = calloc(1, sizeof(struct wl_array));
+		if (files == NULL) {
+			return;
+		}
+		wl_array_init(files);
+		if (!hash_table_set(&dir->icons, name, name_len, files)) {
+			free(files);
+			return;
+		}
+	}
+
+	struct mako_icon_file *file = wl_array_add(files, sizeof(*file));
+	if (file == NULL) {
+		return;
+	}
+	file->size = size;
+	file->scale = scale;
+	file->path = strdup(path);
+}
+
+// Icons used to be looked up with a `<name>.*` glob, so index files under
+// every prefix of their name which is followed by a dot.
+static void index_icon_file(struct mako_icon_dir *dir, const char *file_name,
+		const char *path, int32_t size, int32_t scale) {
+	const char *dot = strchr(file_name, '.');
+	while (dot != NULL) {
+		if (dot != file_name) {
+			add_icon_file(dir, file_name, dot - file_name, path, size, scale);
+		}
+		dot = strchr(dot + 1, '.');
+	}
+}
+
+// Finds the icon size and scale from a path relative to a theme directory.
+// The size is either the first or second path component.
+static bool parse_icon_size(const char *relative_path, int32_t *size,
+		int32_t *scale) {
+	errno = 0;
+	int32_t icon_size = strtol(relative_path, NULL, 10);
+	if (errno || icon_size == 0) {
+		// Try second level subdirectory if failed.
+		errno = 0;
+		while (relative_path[0] != '/') {
+			++relative_path;
+		}
+		++relative_path;
+		icon_size = strtol(relative_path, NULL, 10);
+		if (errno || icon_size == 0) {
+			return false;
+		}
+	}
+
+	int32_t icon_scale = 1;
+	char *scale_str = strchr(relative_path, '@');
+	if (scale_str != NULL) {
+		icon_scale = strtol(scale_str + 1, NULL, 10);
+	}
+
+	*size = icon_size;
+	*scale = icon_scale;
+	return true;
+}
+
+// Indexes the files in `path`. For sized directories, `relative_path` is the
+// path of the directory relative to the theme.
+static void scan_icon_files(struct mako_icon_dir *dir, const char *path,
+		const char *relative_path) {
+	DIR *d = opendir(path);
+	if (d == NULL) {
+		return;
+	}
+	add_dir_stamp(dir, path);
+
+	struct dirent *entry;
+	while ((entry = readdir(d)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 ||
+				strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+
+		char *file_path = mako_asprintf("%s/%s", path, entry->d_name);
+		if (file_path == NULL) {
+			continue;
+		}
+
+		if (!dir->sized) {
+			index_icon_file(dir, entry->d_name, file_path, 0, 1);
+		} else {
+			char *file_relative_path =
+				mako_asprintf("%s/%s", relative_path, entry->d_name);
+			int32_t size, scale;
+			if (file_relative_path != NULL &&
+					parse_icon_size(file_relative_path, &size, &scale)) {
+				index_icon_file(dir, entry->d_name, file_path, size, scale);
+			}
+			free(file_relative_path);
+		}
+		free(file_path);
+	}
+	closedir(d);
+}
+
+// Calls `func` for each non-hidden entry of `path`. Entries which aren't
+// directories are expected to be skipped by `func`.
+static void for_each_subdir(struct mako_icon_dir *dir, const char *path,
+		const char *relative_path,
+		void (*func)(struct mako_icon_dir *dir, const char *path,
+			const char *relative_path)) {
+	DIR *d = opendir(path);
+	if (d == NULL) {
+		return;
+	}
+	add_dir_stamp(dir, path);
+
+	struct dirent *entry;
+	while ((entry = readdir(d)) != NULL) {
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+		char *subdir_path = mako_asprintf("%s/%s", path, entry->d_name);
+		char *subdir_relative_path = relative_path == NULL ?
+			strdup(entry->d_name) :
+			mako_asprintf("%s/%s", relative_path, entry->d_name);
+		if (subdir_path != NULL && subdir_relative_path != NULL) {
+			func(dir, subdir_path, subdir_relative_path);
+		}
+		free(subdir_path);
+		free(subdir_relative_path);
+	}
+	closedir(d);
+}
+
+static void scan_icon_subdir(struct mako_icon_dir *dir, const char *path,
+		const char *relative_path) {
+	for_each_subdir(dir, path, relative_path, scan_icon_files);
+}
+
+static void clear_icon_dir(struct mako_icon_dir *dir) {
+	size_t iter = 0;
+	struct mako_hash_entry *entry;
+	while ((entry = hash_table_next(&dir->icons, &iter)) != NULL) {
+		struct wl_array *files = entry->value;
+		struct mako_icon_file *file;
+		wl_array_for_each(file, files) {
+			free(file->path);
+		}
+		wl_array_release(files);
+		free(files);
+	}
+	hash_table_finish(&dir->icons);
+
+	struct mako_icon_dir_stamp *stamp;
+	wl_array_for_each(stamp, &dir->stamps) {
+		free(stamp->path);
+	}
+	wl_array_release(&dir->stamps);
+	wl_array_init(&dir->stamps);
+}
+
+static void index_icon_dir(struct mako_icon_dir *dir) {
+	clear_icon_dir(dir);
+
+	if (dir->sized) {
+		for_each_subdir(dir, dir->path, NULL, scan_icon_subdir);
+	} else {
+		scan_icon_files(dir, dir->path, NULL);
+	}
+
+	if (dir->stamps.size == 0) {
+		// The directory doesn't exist, but notice if it shows up.
+		add_dir_stamp(dir, dir->path);
+	}
+}
+
+static void destroy_icon_dir(struct mako_icon_dir *dir) {
+	clear_icon_dir(dir);
+	wl_array_release(&dir->stamps);
+	free(dir->path);
+	free(dir);
+}
+
+// Returns the index of the icons in `path`, building it on first use and
+// refreshing it if the directory was modified.
+static struct mako_icon_dir *get_icon_dir(struct mako_state *state,
+		const char *path, bool sized) {
+	char *key = mako_asprintf("%c%s", sized ? 's' : 'u', path);
+	if (key == NULL) {
+		return NULL;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	struct mako_icon_dir *dir =
+		hash_table_get(&state->icon_dirs, key, strlen(key));
+	if (dir == NULL) {
+		dir = calloc(1, sizeof(struct mako_icon_dir));
+		if (dir == NULL) {
+			free(key);
+			return NULL;
+		}
+		dir->path = strdup(path);
+		dir->sized = sized;
+		hash_table_init(&dir->icons);
+		wl_array_init(&dir->stamps);
+		if (!hash_table_set(&state->icon_dirs, key, strlen(key), dir)) {
+			destroy_icon_dir(dir);
+			free(key);
+			return NULL;
+		}
+
+		index_icon_dir(dir);
+		dir->checked_at = now;
+	} else if (now.tv_sec - dir->checked_at.tv_sec >= ICON_DIR_CHECK_INTERVAL) {
+		if (icon_dir_changed(dir)) {
+			index_icon_dir(dir);
+		}
+		dir->checked_at = now;
+	}
+
+	free(key);
+	return dir;
+}
+
+static struct wl_array *find_icon_files(struct mako_state *state,
+		const char *path, bool sized, const char *icon_name) {
+	struct mako_icon_dir *dir = get_icon_dir(state, path, sized);
+	if (dir == NULL) {
+		return NULL;
+	}
+	return hash_table_get(&dir->icons, icon_name, strlen(icon_name));
+}
+
 // Attempt to find a full path for a notification's icon_name, which may be:
 // - An absolute path, which will simply be returned (as a new string)
 // - A file:// URI, which will be converted to an absolute path
@@ -101,9 +403,11 @@ static void url_decode(char *dst, const char *src) {
 //   `icon-path` using something that looks vaguely like the algorithm defined
 //   in the icon theme spec (https://standards.freedesktop.org/icon-theme-spec/icon-theme-spec-latest.html)
 //
+// Icon files are chosen to look sharp on an output with the given scale.
+//
 // Returns the resolved path, or NULL if it was unable to find an icon. The
 // return value must be freed by the caller.
-static char *resolve_icon(struct mako_notification *notif) {
+static char *resolve_icon(struct mako_notification *notif, int32_t scale) {
 	char *icon_name = notif->app_icon;
 	if (icon_name[0] == '\0') {
 		return NULL;
@@ -122,30 +426,17 @@ static char *resolve_icon(struct mako_notification *notif) {
 		return icon_path;
 	}
 
-	// Determine the largest scale factor of any attached output.
-	int32_t max_scale = 1;
-	struct mako_output *output = NULL;
-	wl_list_for_each(output, &notif->state->outputs, link) {
-		if (output->scale > max_scale) {
-			max_scale = output->scale;
-		}
-	}
-
 	static const char fallback[] = "%s:/usr/share/icons/hicolor";
 	char *search = mako_asprintf(fallback, notif->style.icon_path);
 
 	char *saveptr = NULL;
 	char *theme_path = strtok_r(search, ":", &saveptr);
 
-	// Match all icon files underneath of the theme_path followed by any icon
-	// size and category subdirectories. This pattern assumes that all the
-	// files in the icon path are valid icon types.
-	static const char pattern_fmt[] = "%s/*/*/%s.*";
-
 	char *icon_path = NULL;
 	int32_t last_icon_size = 0;
 
 	if (!validate_icon_name(icon_name)) {
+		free(search);
 		return NULL;
 	}
 
@@ -154,71 +445,34 @@ static char *resolve_icon(struct mako_notification *notif) {
 			continue;
 		}
 
-		glob_t icon_glob = {0};
-		char *pattern = mako_asprintf(pattern_fmt, theme_path, icon_name);
-
-		// Disable sorting because we're going to do our own anyway.
-		int found = glob(pattern, GLOB_NOSORT, NULL, &icon_glob);
-		size_t found_count = 0;
-		if (found == 0) {
-			// The value of gl_pathc isn't guaranteed to be usable if glob
-			// returns non-zero.
-			found_count = icon_glob.gl_pathc;
-		}
-
-		for (size_t i = 0; i < found_count; ++i) {
-			char *relative_path = icon_glob.gl_pathv[i];
-
-			// Find the end of the current search path and walk to the next
-			// path component. Hopefully this will be the icon resolution
-			// subdirectory.
-			relative_path += strlen(theme_path);
-			while (relative_path[0] == '/') {
-				++relative_path;
-			}
-
-			errno = 0;
-			int32_t icon_size = strtol(relative_path, NULL, 10);
-			if (errno || icon_size == 0) {
-				// Try second level subdirectory if failed.
-				errno = 0;
-				while (relative_path[0] != '/') {
-					++relative_path;
+		// All the icon files underneath of the theme_path, in any icon size
+		// and category subdirectories. This assumes that all the files in
+		// the icon path are valid icon types.
+		struct wl_array *files =
+			find_icon_files(notif->state, theme_path, true, icon_name);
+		if (files != NULL) {
+			struct mako_icon_file *file;
+			wl_array_for_each(file, files) {
+				if (file->size == notif->style.max_icon_size &&
+						file->scale == scale) {
+					// If we find an exact match, we're done.
+					free(icon_path);
+					icon_path = strdup(file->path);
+					break;
+				} else if (file->size < notif->style.max_icon_size * scale &&
+						file->size > last_icon_size) {
+					// Otherwise, if this icon is small enough to fit but
+					// bigger than the last best match, choose it on a
+					// provisional basis. We multiply by scale to increase
+					// the odds of finding an icon which looks sharp on the
+					// output.
+					free(icon_path);
+					icon_path = strdup(file->path);
+					last_icon_size = file->size;
 				}
-				++relative_path;
-				icon_size = strtol(relative_path, NULL, 10);
-				if (errno || icon_size == 0) {
-					continue;
-				}
-			}
-
-			int32_t icon_scale = 1;
-			char *scale_str = strchr(relative_path, '@');
-			if (scale_str != NULL) {
-				icon_scale = strtol(scale_str + 1, NULL, 10);
-			}
-
-			if (icon_size == notif->style.max_icon_size &&
-					icon_scale == max_scale) {
-				// If we find an exact match, we're done.
-				free(icon_path);
-				icon_path = strdup(icon_glob.gl_pathv[i]);
-				break;
-			} else if (icon_size < notif->style.max_icon_size * max_scale &&
-					icon_size > last_icon_size) {
-				// Otherwise, if this icon is small enough to fit but bigger
-				// than the last best match, choose it on a provisional basis.
-				// We multiply by max_scale to increase the odds of finding an
-				// icon which looks sharp on the highest-scale output.
-				free(icon_path);
-				icon_path = strdup(icon_glob.gl_pathv[i]);
-				last_icon_size = icon_size;
 			}
 		}
 
-		free(pattern);
-		globfree(&icon_glob);
-
 		if (icon_path) {
 			// The spec says that if we find any match whatsoever in a theme,
 			// we should stop there to avoid mixing icons from different
@@ -232,80 +486,547 @@ static char *resolve_icon(struct mako_notification *notif) {
 		// Finally, fall back to looking in /usr/share/pixmaps. These are
 		// unsized icons, which may lead to downscaling, but some apps are
 		// still using it.
-		static const char pixmaps_fmt[] = "/usr/share/pixmaps/%s.*";
+		struct wl_array *files = find_icon_files(notif->state,
+			"/usr/share/pixmaps", false, icon_name);
+		if (files != NULL && files->size > 0) {
+			struct mako_icon_file *file = files->data;
+			icon_path = strdup(file->path);
+		}
+	}
+
+	free(search);
+	return icon_path;
+}
 
-		char *pattern = mako_asprintf(pixmaps_fmt, icon_name);
+struct mako_icon_cache_entry {
+	struct wl_list link; // mako_icon_cache::lru
+	void *key;
+	size_t key_len;
+	size_t size; // in bytes
+	cairo_surface_t *surface;
+	// Image data only, without row padding. The key only holds a hash of
+	// it, which senders could make collide.
+	uint8_t *pixels;
+	size_t pixels_len;
+};
 
-		glob_t icon_glob = {0};
-		int found = glob(pattern, GLOB_NOSORT, NULL, &icon_glob);
+enum mako_icon_source {
+	MAKO_ICON_SOURCE_FILE,
+	MAKO_ICON_SOURCE_IMAGE_DATA,
+};
 
-		if (found == 0 && icon_glob.gl_pathc > 0) {
-			icon_path = strdup(icon_glob.gl_pathv[0]);
+// The fixed-size part of a cache key. File keys are followed by the path.
+struct mako_icon_cache_key {
+	uint32_t source; // enum mako_icon_source
+	int32_t max_icon_size;
+	int32_t scale;
+	// Files only
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	// Image data only
+	int32_t width;
+	int32_t height;
+	uint32_t has_alpha;
+	uint64_t content_hash;
+};
+
+static void init_icon_cache_key(struct mako_icon_cache_key *header,
+		enum mako_icon_source source, int32_t max_icon_size, int32_t scale) {
+	memset(header, 0, sizeof(*header));
+	header->source = source;
+	header->max_icon_size = max_icon_size;
+	header->scale = scale;
+}
+
+static void *create_icon_cache_key(const char *path, const struct stat *st,
+		int32_t max_icon_size, int32_t scale, size_t *key_len) {
+	struct mako_icon_cache_key header;
+	init_icon_cache_key(&header, MAKO_ICON_SOURCE_FILE, max_icon_size, scale);
+	header.mtime_sec = st->st_mtim.tv_sec;
+	header.mtime_nsec = st->st_mtim.tv_nsec;
+
+	size_t path_len = strlen(path);
+	*key_len = sizeof(header) + path_len;
+	char *key = malloc(*key_len);
+	if (key == NULL) {
+		return NULL;
+	}
+	memcpy(key, &header, sizeof(header));
+	memcpy(key + sizeof(header), path, path_len);
+	return key;
+}
+
+// Image data is keyed by a hash of its contents, so that clients attaching the
+// same picture (e.g. an avatar) to every notification share a single surface.
+// Row padding isn't part of the image and is left out of the hash.
+static void *create_image_data_cache_key(
+		const struct mako_image_data *image_data, int32_t max_icon_size,
+		int32_t scale, size_t *key_len) {
+	struct mako_icon_cache_key *key = malloc(sizeof(*key));
+	if (key == NULL) {
+		return NULL;
+	}
+	init_icon_cache_key(key, MAKO_ICON_SOURCE_IMAGE_DATA, max_icon_size,
+		scale);
+	key->width = image_data->width;
+	key->height = image_data->height;
+	key->has_alpha = image_data->has_alpha;
+
+	size_t row_len = (size_t)image_data->width * image_data->channels;
+	uint64_t hash = hash_bytes(NULL, 0);
+	for (int32_t y = 0; y < image_data->height; ++y) {
+		hash = hash_bytes_update(hash,
+			image_data->data + (size_t)y * image_data->rowstride, row_len);
+	}
+	key->content_hash = hash;
+
+	*key_len = sizeof(*key);
+	return key;
+}
+
+static void destroy_icon_cache_entry(struct mako_icon_cache *cache,
+		struct mako_icon_cache_entry *entry) {
+	hash_table_remove(&cache->entries, entry->key, entry->key_len);
+	wl_list_remove(&entry->link);
+	cache->size -= entry->size;
+	cairo_surface_destroy(entry->surface);
+	free(entry->key);
+	free(entry->pixels);
+	free(entry);
+}
+
+// Drops least recently used entries until the cache fits in `max_size`.
+// Surfaces still used by an icon are kept, as dropping them wouldn't free any
+// memory and would prevent them from being shared.
+static void trim_icon_cache(struct mako_icon_cache *cache, size_t max_size) {
+	struct mako_icon_cache_entry *entry, *tmp;
+	wl_list_for_each_reverse_safe(entry, tmp, &cache->lru, link) {
+		if (cache->size <= max_size) {
+			break;
+		}
+		if (cairo_surface_get_reference_count(entry->surface) > 1) {
+			continue;
 		}
-		free(pattern);
-		globfree(&icon_glob);
+		destroy_icon_cache_entry(cache, entry);
 	}
+}
 
-	free(search);
-	return icon_path;
+typedef cairo_surface_t *(*mako_icon_loader_t)(const void *data);
+
+static cairo_surface_t *load_icon_surface(const void *data) {
+	const char *path = data;
+	GdkPixbuf *image = load_image(path);
+	if (image == NULL) {
+		return NULL;
+	}
+	cairo_surface_t *surface = create_cairo_surface_from_gdk_pixbuf(image);
+	g_object_unref(image);
+	return surface;
+}
+
+static cairo_surface_t *load_image_data_surface(const void *data) {
+	const struct mako_image_data *image_data = data;
+	cairo_surface_t *surface = create_cairo_surface_from_pixels(
+		image_data->data, image_data->width, image_data->height,
+		image_data->rowstride, image_data->has_alpha);
+	if (surface == NULL) {
+		fprintf(stderr, "Failed to load icon\n");
+	}
+	return surface;
+}
+
+// Downscales a decoded image to the size it will be shown at on an output
+// with the given scale, so that drawing it is a plain blit and the full
+// resolution image doesn't need to be kept around. Images which are already
+// small enough are returned as is.
+static cairo_surface_t *prescale_icon_surface(cairo_surface_t *image,
+		int32_t max_icon_size, int32_t scale) {
+	int image_width = cairo_image_surface_get_width(image);
+	int image_height = cairo_image_surface_get_height(image);
+	double factor = fit_to_square(image_width, image_height,
+		max_icon_size * scale);
+	if (factor >= 1.0) {
+		return image;
+	}
+
+	int width = image_width * factor + 0.5;
+	int height = image_height * factor + 0.5;
+	if (width < 1) {
+		width = 1;
+	}
+	if (height < 1) {
+		height = 1;
+	}
+
+	cairo_surface_t *scaled = cairo_image_surface_create(
+		cairo_image_surface_get_format(image), width, height);
+	if (cairo_surface_status(scaled) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(scaled);
+		return image;
+	}
+
+	cairo_t *cairo = cairo_create(scaled);
+	cairo_scale(cairo, (double)width / image_width,
+		(double)height / image_height);
+	cairo_set_source_surface(cairo, image, 0, 0);
+	cairo_pattern_set_filter(cairo_get_source(cairo), CAIRO_FILTER_GOOD);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(cairo);
+	cairo_destroy(cairo);
+
+	cairo_surface_destroy(image);
+	return scaled;
+}
+
+static cairo_surface_t *load_scaled_icon_surface(mako_icon_loader_t load,
+		const void *data, int32_t max_icon_size, int32_t scale) {
+	cairo_surface_t *surface = load(data);
+	if (surface == NULL) {
+		return NULL;
+	}
+	return prescale_icon_surface(surface, max_icon_size, scale);
+}
+
+static size_t image_data_pixels_len(const struct mako_image_data *image_data) {
+	return (size_t)image_data->width * image_data->channels *
+		image_data->height;
+}
+
+static bool image_data_equal(const struct mako_icon_cache_entry *entry,
+		const struct mako_image_data *image_data) {
+	if (entry->pixels_len != image_data_pixels_len(image_data)) {
+		return false;
+	}
+	size_t row_len = (size_t)image_data->width * image_data->channels;
+	for (int32_t y = 0; y < image_data->height; ++y) {
+		if (memcmp(entry->pixels + (size_t)y * row_len,
+				image_data->data + (size_t)y * image_data->rowstride,
+				row_len) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint8_t *copy_image_data_pixels(
+		const struct mako_image_data *image_data) {
+	size_t row_len = (size_t)image_data->width * image_data->channels;
+	uint8_t *pixels = malloc(image_data_pixels_len(image_data));
+	if (pixels == NULL) {
+		return NULL;
+	}
+	for (int32_t y = 0; y < image_data->height; ++y) {
+		memcpy(pixels + (size_t)y * row_len,
+			image_data->data + (size_t)y * image_data->rowstride, row_len);
+	}
+	return pixels;
+}
+
+// Looks up `key` in the cache, calling `load` on a miss. Takes ownership of
+// `key`. `image_data` is checked against the cached pixels on a hit, and is
+// NULL for files. The returned reference must be released by the caller.
+static cairo_surface_t *get_cached_icon_surface(struct mako_state *state,
+		void *key, size_t key_len, mako_icon_loader_t load, const void *data,
+		const struct mako_image_data *image_data, int32_t max_icon_size,
+		int32_t scale) {
+	struct mako_icon_cache *cache = &state->icon_cache;
+	size_t max_size = state->config.icon_cache_size;
+
+	struct mako_icon_cache_entry *entry =
+		hash_table_get(&cache->entries, key, key_len);
+	if (entry != NULL && image_data != NULL &&
+			!image_data_equal(entry, image_data)) {
+		// Another image with the same hash, don't cache this one
+		free(key);
+		return load_scaled_icon_surface(load, data, max_icon_size, scale);
+	}
+	if (entry != NULL) {
+		++state->stats.icon_hits;
+		free(key);
+		wl_list_remove(&entry->link);
+		wl_list_insert(&cache->lru, &entry->link);
+		return cairo_surface_reference(entry->surface);
+	}
+	++state->stats.icon_misses;
+
+	cairo_surface_t *surface =
+		load_scaled_icon_surface(load, data, max_icon_size, scale);
+	if (surface == NULL) {
+		free(key);
+		return NULL;
+	}
+
+	size_t size = (size_t)cairo_image_surface_get_stride(surface) *
+		cairo_image_surface_get_height(surface);
+	uint8_t *pixels = NULL;
+	size_t pixels_len = 0;
+	if (image_data != NULL) {
+		pixels_len = image_data_pixels_len(image_data);
+		size += pixels_len;
+	}
+	if (size > max_size) {
+		free(key);
+		return surface;
+	}
+	if (image_data != NULL &&
+			(pixels = copy_image_data_pixels(image_data)) == NULL) {
+		free(key);
+		return surface;
+	}
+
+	entry = calloc(1, sizeof(struct mako_icon_cache_entry));
+	if (entry == NULL || !hash_table_set(&cache->entries, key, key_len, entry)) {
+		free(entry);
+		free(key);
+		free(pixels);
+		return surface;
+	}
+	entry->key = key;
+	entry->key_len = key_len;
+	entry->pixels = pixels;
+	entry->pixels_len = pixels_len;
+	entry->size = size;
+	entry->surface = cairo_surface_reference(surface);
+	wl_list_insert(&cache->lru, &entry->link);
+	cache->size += size;
+
+	trim_icon_cache(cache, max_size);
+	return surface;
+}
+
+// Loads an icon file, sharing the decoded surface with other icons created
+// from the same file. The returned reference must be released by the caller.
+static cairo_surface_t *load_cached_icon_surface(struct mako_state *state,
+		const char *path, int32_t max_icon_size, int32_t scale) {
+	size_t max_size = state->config.icon_cache_size;
+
+	struct stat st;
+	if (max_size == 0 || stat(path, &st) != 0) {
+		trim_icon_cache(&state->icon_cache, max_size);
+		return load_scaled_icon_surface(load_icon_surface, path,
+			max_icon_size, scale);
+	}
+
+	size_t key_len;
+	void *key = create_icon_cache_key(path, &st, max_icon_size, scale,
+		&key_len);
+	if (key == NULL) {
+		return load_scaled_icon_surface(load_icon_surface, path,
+			max_icon_size, scale);
+	}
+	return get_cached_icon_surface(state, key, key_len, load_icon_surface,
+		path, NULL, max_icon_size, scale);
+}
+
+// Same as load_cached_icon_surface(), for image data sent over D-Bus.
+static cairo_surface_t *load_cached_image_data_surface(
+		struct mako_state *state, const struct mako_image_data *image_data,
+		int32_t max_icon_size, int32_t scale) {
+	size_t max_size = state->config.icon_cache_size;
+	if (max_size == 0) {
+		trim_icon_cache(&state->icon_cache, max_size);
+		return load_scaled_icon_surface(load_image_data_surface, image_data,
+			max_icon_size, scale);
+	}
+
+	size_t key_len;
+	void *key = create_image_data_cache_key(image_data, max_icon_size, scale,
+		&key_len);
+	if (key == NULL) {
+		return load_scaled_icon_surface(load_image_data_surface, image_data,
+			max_icon_size, scale);
+	}
+	return get_cached_icon_surface(state, key, key_len,
+		load_image_data_surface, image_data, image_data, max_icon_size, scale);
+}
+
+// Prepares the icon for an output with the given scale, from the full
+// resolution image data or by loading the icon file again.
+static cairo_surface_t *prepare_icon_image(struct mako_icon *icon,
+		int32_t scale) {
+	if (icon->source != NULL) {
+		return prescale_icon_surface(cairo_surface_reference(icon->source),
+			icon->max_icon_size, scale);
+	}
+
+	char *path = resolve_icon(icon->notif, scale);
+	if (path == NULL) {
+		return NULL;
+	}
+	cairo_surface_t *surface = load_cached_icon_surface(icon->notif->state,
+		path, icon->max_icon_size, scale);
+	free(path);
+	return surface;
+}
+
+static cairo_surface_t *get_icon_image(struct mako_icon *icon,
+		int32_t scale) {
+	struct mako_icon_image *image;
+	wl_array_for_each(image, &icon->images) {
+		if (image->scale == scale) {
+			return image->surface;
+		}
+	}
+
+	cairo_surface_t *surface = prepare_icon_image(icon, scale);
+	if (surface == NULL) {
+		return NULL;
+	}
+	image = wl_array_add(&icon->images, sizeof(struct mako_icon_image));
+	if (image == NULL) {
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+	image->scale = scale;
+	image->surface = surface;
+	return surface;
 }
 
 struct mako_icon *create_icon(struct mako_notification *notif) {
-	GdkPixbuf *image = NULL;
+	struct mako_state *state = notif->state;
+	int32_t max_icon_size = notif->style.max_icon_size;
+	// Prepared for the highest output scale first, it's the most likely to be
+	// drawn. Other scales are prepared when they are first drawn at.
+	int32_t scale = get_max_scale(state);
+
+	cairo_surface_t *surface = NULL;
+	cairo_surface_t *source = NULL;
 	if (notif->image_data != NULL) {
-		image = load_image_data(notif->image_data);
+		surface = load_cached_image_data_surface(state, notif->image_data,
+			max_icon_size, scale);
+		// The image data is released once the notification is ingested, so
+		// keep a full resolution copy to prepare the icon for other scales.
+		// Images which fit at scale 1 are never downscaled, and are the same
+		// at every scale.
+		if (surface != NULL && fit_to_square(notif->image_data->width,
+				notif->image_data->height, max_icon_size) >= 1.0) {
+			source = cairo_surface_reference(surface);
+		} else if (surface != NULL) {
+			source = load_image_data_surface(notif->image_data);
+			if (source == NULL) {
+				cairo_surface_destroy(surface);
+				surface = NULL;
+			}
+		}
 	}
 
-	if (image == NULL) {
-		char *path = resolve_icon(notif);
+	if (surface == NULL) {
+		char *path = resolve_icon(notif, scale);
 		if (path == NULL) {
 			return NULL;
 		}
 
-		image = load_image(path);
+		surface = load_cached_icon_surface(state, path, max_icon_size, scale);
 		free(path);
-		if (image == NULL) {
+		if (surface == NULL) {
 			return NULL;
 		}
 	}
 
-	int image_width = gdk_pixbuf_get_width(image);
-	int image_height = gdk_pixbuf_get_height(image);
-
 	struct mako_icon *icon = calloc(1, sizeof(struct mako_icon));
-	icon->scale = fit_to_square(
-			image_width, image_height, notif->style.max_icon_size);
-	icon->width = image_width * icon->scale;
-	icon->height = image_height * icon->scale;
+	if (icon == NULL) {
+		cairo_surface_destroy(surface);
+		if (source != NULL) {
+			cairo_surface_destroy(source);
+		}
+		return NULL;
+	}
+	icon->notif = notif;
+	icon->max_icon_size = max_icon_size;
+	icon->source = source;
+	wl_array_init(&icon->images);
 
-	icon->image = create_cairo_surface_from_gdk_pixbuf(image);
-	g_object_unref(image);
-	if (icon->image == NULL) {
-		free(icon);
+	struct mako_icon_image *image =
+		wl_array_add(&icon->images, sizeof(struct mako_icon_image));
+	if (image == NULL) {
+		cairo_surface_destroy(surface);
+		destroy_icon(icon);
 		return NULL;
 	}
+	image->scale = scale;
+	image->surface = surface;
+
+	int image_width = cairo_image_surface_get_width(surface);
+	int image_height = cairo_image_surface_get_height(surface);
+	double factor = fit_to_square(image_width, image_height, max_icon_size);
+	icon->width = image_width * factor;
+	icon->height = image_height * factor;
 
 	return icon;
 }
+
+void init_icons(struct mako_state *state) {
+	hash_table_init(&state->icon_dirs);
+	hash_table_init(&state->icon_cache.entries);
+	wl_list_init(&state->icon_cache.lru);
+	state->icon_cache.size = 0;
+}
+
+void finish_icons(struct mako_state *state) {
+	size_t iter = 0;
+	struct mako_hash_entry *entry;
+	while ((entry = hash_table_next(&state->icon_dirs, &iter)) != NULL) {
+		destroy_icon_dir(entry->value);
+	}
+	hash_table_finish(&state->icon_dirs);
+
+	struct mako_icon_cache_entry *cache_entry, *tmp;
+	wl_list_for_each_safe(cache_entry, tmp, &state->icon_cache.lru, link) {
+		destroy_icon_cache_entry(&state->icon_cache, cache_entry);
+	}
+	hash_table_finish(&state->icon_cache.entries);
+}
 #else
+static cairo_surface_t *get_icon_image(struct mako_icon *icon,
+		int32_t scale) {
+	return NULL;
+}
+
 struct mako_icon *create_icon(struct mako_notification *notif) {
 	return NULL;
 }
+
+void init_icons(struct mako_state *state) {
+	hash_table_init(&state->icon_dirs);
+	hash_table_init(&state->icon_cache.entries);
+	wl_list_init(&state->icon_cache.lru);
+	state->icon_cache.size = 0;
+}
+
+void finish_icons(struct mako_state *state) {
+	hash_table_finish(&state->icon_dirs);
+	hash_table_finish(&state->icon_cache.entries);
+}
 #endif
 
 void draw_icon(cairo_t *cairo, struct mako_icon *icon,
 		double xpos, double ypos, double scale) {
+	cairo_surface_t *image = get_icon_image(icon, (int32_t)scale);
+	if (image == NULL) {
+		// Fall back to the image prepared when the icon was created
+		struct mako_icon_image *first = icon->images.data;
+		image = first->surface;
+	}
+
+	// Logical pixels per image pixel
+	double factor = icon->width / cairo_image_surface_get_width(image);
+
 	cairo_save(cairo);
-	cairo_scale(cairo, scale*icon->scale, scale*icon->scale);
-	cairo_set_source_surface(cairo, icon->image, xpos/icon->scale, ypos/icon->scale);
+	cairo_scale(cairo, scale*factor, scale*factor);
+	cairo_set_source_surface(cairo, image, xpos/factor, ypos/factor);
 	cairo_paint(cairo);
 	cairo_restore(cairo);
 }
 
 void destroy_icon(struct mako_icon *icon) {
 	if (icon != NULL) {
-		if (icon->image != NULL) {
-			cairo_surface_destroy(icon->image);
+		struct mako_icon_image *image;
+		wl_array_for_each(image, &icon->images) {
+			cairo_surface_destroy(image->surface);
+		}
+		wl_array_release(&icon->images);
+		if (icon->source != NULL) {
+			cairo_surface_destroy(icon->source);
 		}
 		free(icon);
 	}
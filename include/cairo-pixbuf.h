@@ -5,9 +5,30 @@
 #error "gdk_pixbuf is required"
 #endif
 
+#include <stdbool.h>
 #include <cairo/cairo.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_DISPATCH
+#endif
+
 cairo_surface_t *create_cairo_surface_from_gdk_pixbuf(const GdkPixbuf *pixbuf);
+// Converts 8-bit RGB or RGBA pixels to a (premultiplied) cairo image surface.
+cairo_surface_t *create_cairo_surface_from_pixels(const guint8 *pixels,
+	int width, int height, int rowstride, bool has_alpha);
+
+// Converts a row of RGBA pixels to premultiplied ARGB32. The vectorized
+// variants give exactly the same result as the scalar one, and are only
+// exposed for bench/premul.c.
+typedef void (*convert_row_func)(unsigned char *dst, const guint8 *src, int width);
+void convert_rgba_row_scalar(unsigned char *dst, const guint8 *src, int width);
+#if defined(__SSE2__)
+void convert_rgba_row_sse2(unsigned char *dst, const guint8 *src, int width);
+#endif
+#if defined(HAVE_AVX2_DISPATCH)
+// Only if __builtin_cpu_supports("avx2")
+void convert_rgba_row_avx2(unsigned char *dst, const guint8 *src, int width);
+#endif
 
 #endif
@@ -41,7 +41,7 @@ enum mako_icon_location {
 struct mako_style_spec {
 	bool width, height, outer_margin, margin, padding, border_size, border_radius, font,
 		markup, format, text_alignment, actions, default_timeout, ignore_timeout,
-		icons, max_icon_size, icon_path, icon_border_radius, group_criteria_spec, invisible, history,
+		exec_timeout, icons, max_icon_size, icon_path, icon_border_radius, group_criteria_spec, invisible, history,
 		icon_location, max_visible, layer, output, anchor;
 	struct {
 		bool background, text, border, progress;
@@ -77,6 +77,7 @@ struct mako_style {
 	bool actions;
 	int default_timeout; // in ms
 	bool ignore_timeout;
+	int exec_timeout; // in ms, 0 for none
 
 	struct {
 		uint32_t background;
@@ -102,12 +103,23 @@ struct mako_style {
 	struct mako_binding touch_binding, notify_binding;
 };
 
+struct mako_criteria_index;
+
 struct mako_config {
 	struct wl_list criteria; // mako_criteria::link
+	// Lookup structure built from the criteria list, see compile_criteria
+	struct mako_criteria_index *criteria_index;
+	uint32_t serial; // Incremented on every reload
 
 	uint32_t sort_criteria; //enum mako_sort_criteria
 	uint32_t sort_asc;
 	int32_t max_history;
+	size_t icon_cache_size; // in bytes
+	int32_t timer_slack; // in milliseconds
+	bool persistent_history;
+	int32_t max_persistent_history;
+	int32_t max_exec; // Concurrently running exec bindings, 0 for no limit
+	bool exec_helper; // Only read at startup, see start_spawn_helper()
 
 	struct mako_style superstyle;
 };
@@ -14,6 +14,7 @@ struct mako_notification;
 struct mako_criteria {
 	struct mako_criteria_spec spec;
 	struct wl_list link; // mako_config::criteria
+	size_t position; // Index in mako_config::criteria, set by compile_criteria
 
 	char *raw_string; // For debugging
 
@@ -53,8 +54,11 @@ bool parse_criteria(const char *string, struct mako_criteria *criteria);
 bool apply_criteria_field(struct mako_criteria *criteria, char *token);
 
 struct mako_criteria *global_criteria(struct mako_config *config);
-ssize_t apply_each_criteria(struct wl_list *criteria_list,
+bool compile_criteria(struct mako_config *config);
+void destroy_criteria_index(struct mako_criteria_index *index);
+ssize_t apply_each_criteria(struct mako_config *config,
 		struct mako_notification *notif);
+ssize_t resolve_notification_style(struct mako_notification *notif);
 struct mako_criteria *create_criteria_from_notification(
 		struct mako_notification *notif, struct mako_criteria_spec *spec);
 
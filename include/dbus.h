@@ -28,6 +28,10 @@ int init_dbus_xdg(struct mako_state *state);
 void emit_modes_changed(struct mako_state *state);
 
 void emit_notifications_changed(struct mako_state *state);
+void emit_notification_added(struct mako_notification *notif);
+void emit_notification_updated(struct mako_notification *notif);
+void emit_notification_removed(struct mako_notification *notif,
+	enum mako_notification_close_reason reason);
 
 int init_dbus_mako(struct mako_state *state);
 
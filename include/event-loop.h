@@ -1,8 +1,9 @@
 #ifndef MAKO_EVENT_LOOP_H
 #define MAKO_EVENT_LOOP_H
 
-#include <poll.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/epoll.h>
 #include <time.h>
 #include <wayland-client.h>
 #if defined(HAVE_LIBSYSTEMD)
@@ -13,42 +14,89 @@
 #include <basu/sd-bus.h>
 #endif
 
-enum mako_event {
-	MAKO_EVENT_DBUS,
-	MAKO_EVENT_WAYLAND,
-	MAKO_EVENT_TIMER,
-	MAKO_EVENT_SIGNAL,
-	MAKO_EVENT_COUNT, // keep last
-};
+typedef void (*mako_event_loop_timer_func_t)(void *data);
 
 struct mako_event_loop {
-	struct pollfd fds[MAKO_EVENT_COUNT];
+	int epoll_fd;
 	sd_bus *bus;
 	struct wl_display *display;
-	int sfd;
+	int sfd, timer_fd;
+
+	struct wl_list sources; // mako_event_source::link
+	// Sources destroyed while dispatching, freed at the end of the iteration
+	struct wl_list destroyed_sources;
+	struct mako_event_source *dbus_source, *wayland_source, *timer_source,
+		*signal_source;
 
 	bool running;
-	struct wl_list timers; // mako_timer::link
-	struct mako_timer *next_timer;
+	// Binary min-heap of struct mako_timer *, ordered by deadline
+	struct wl_array timers;
+	// Deadline the timerfd is currently armed for, if any
+	bool timer_armed;
+	struct timespec timer_armed_at;
+	// Called after each pass over the due timers, see
+	// set_event_loop_timers_done()
+	mako_event_loop_timer_func_t timers_done_func;
+	void *timers_done_data;
+	struct wl_list idles; // mako_idle::link
 };
 
-typedef void (*mako_event_loop_timer_func_t)(void *data);
+// `events` is a mask of EPOLLIN, EPOLLOUT, EPOLLERR and EPOLLHUP. Returning a
+// negative value stops the event loop with an error.
+typedef int (*mako_event_loop_fd_func_t)(int fd, uint32_t events, void *data);
+
+struct mako_event_source {
+	struct mako_event_loop *event_loop;
+	struct wl_list link;
+	int fd; // -1 once destroyed
+	uint32_t events;
+	mako_event_loop_fd_func_t func;
+	void *user_data;
+};
 
 struct mako_timer {
 	struct mako_event_loop *event_loop;
 	mako_event_loop_timer_func_t func;
 	void *user_data;
 	struct timespec at;
-	struct wl_list link; // mako_event_loop::timers
+	size_t heap_index; // position in mako_event_loop::timers
+};
+
+typedef void (*mako_event_loop_idle_func_t)(void *data);
+
+// Runs once, at the start of the next event loop iteration
+struct mako_idle {
+	struct wl_list link;
+	mako_event_loop_idle_func_t func;
+	void *user_data;
 };
 
 bool init_event_loop(struct mako_event_loop *loop, sd_bus *bus,
 	struct wl_display *display);
 void finish_event_loop(struct mako_event_loop *loop);
 int run_event_loop(struct mako_event_loop *loop);
+
+// Calls `func` whenever `fd` is ready for one of `events` (EPOLLIN and/or
+// EPOLLOUT). Errors and hang-ups are always reported. The fd isn't closed
+// when the source is destroyed.
+struct mako_event_source *add_event_loop_fd(struct mako_event_loop *loop,
+	int fd, uint32_t events, mako_event_loop_fd_func_t func, void *data);
+bool update_event_source(struct mako_event_source *source, uint32_t events);
+void destroy_event_source(struct mako_event_source *source);
+
+// The deadline is rounded up to a multiple of `slack_ms` if it's positive,
+// so that timers added around the same time are run together.
 struct mako_timer *add_event_loop_timer(struct mako_event_loop *loop,
-	int delay_ms, mako_event_loop_timer_func_t func, void *data);
+	int delay_ms, int slack_ms, mako_event_loop_timer_func_t func, void *data);
 
 void destroy_timer(struct mako_timer *timer);
+// Calls `func` once all of the timers which are due together have run, so
+// that their callbacks can defer work and handle it as a batch.
+void set_event_loop_timers_done(struct mako_event_loop *loop,
+	mako_event_loop_timer_func_t func, void *data);
+
+struct mako_idle *add_event_loop_idle(struct mako_event_loop *loop,
+	mako_event_loop_idle_func_t func, void *data);
+void destroy_idle(struct mako_idle *idle);
 
 #endif
@@ -0,0 +1,43 @@
+#ifndef MAKO_HASH_TABLE_H
+#define MAKO_HASH_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A simple open-addressing hash table mapping byte strings to pointers. Keys
+// are copied into the table, values are owned by the caller.
+struct mako_hash_entry {
+	uint64_t hash;
+	void *key; // NULL if the slot is empty
+	size_t key_len;
+	void *value;
+};
+
+struct mako_hash_table {
+	struct mako_hash_entry *entries;
+	size_t capacity; // always zero or a power of two
+	size_t len;
+	size_t tombstones;
+};
+
+void hash_table_init(struct mako_hash_table *table);
+void hash_table_finish(struct mako_hash_table *table);
+
+void *hash_table_get(const struct mako_hash_table *table,
+	const void *key, size_t key_len);
+bool hash_table_set(struct mako_hash_table *table,
+	const void *key, size_t key_len, void *value);
+// Returns the value that was stored for the key, or NULL.
+void *hash_table_remove(struct mako_hash_table *table,
+	const void *key, size_t key_len);
+
+// Iterates over all entries. `iter` must be initialized to zero. Entries must
+// not be added while iterating, but the current one may be removed.
+struct mako_hash_entry *hash_table_next(const struct mako_hash_table *table,
+	size_t *iter);
+
+uint64_t hash_bytes(const void *data, size_t len);
+uint64_t hash_bytes_update(uint64_t hash, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef MAKO_HISTORY_LOG_H
+#define MAKO_HISTORY_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// The persistent history is an append-only log of closed notifications, and
+// an index of the offsets of its records. Both files are in native byte order
+// and start with an 8-byte magic, a version and a generation, which tells
+// whether the index belongs to the log:
+//
+//   history.log: "MAKOHLOG", version, then the records, oldest first
+//   history.idx: "MAKOHIDX", version, then one uint64_t offset per record
+//
+// A record is a uint32_t length followed by that many bytes: the fixed-size
+// fields, then NUL-terminated strings. It's only written by the daemon, which
+// keeps it to a bounded size by compacting it once in a while, and read
+// directly by makoctl.
+
+// A closed notification, as stored in the log
+struct mako_history_record {
+	uint32_t id;
+	uint32_t urgency;
+	int32_t requested_timeout;
+	int32_t progress;
+	struct timespec closed_at; // CLOCK_REALTIME
+
+	const char *app_name;
+	const char *app_icon;
+	const char *summary;
+	const char *body;
+	const char *category;
+	const char *desktop_entry;
+	const char *tag;
+	// actions_len pairs of key and title, as consecutive NUL-terminated
+	// strings, see next_history_record_string()
+	const char *actions;
+	size_t actions_len;
+};
+
+struct mako_history_log {
+	char *log_path, *index_path;
+	int log_fd, index_fd;
+	uint64_t log_size;
+	uint32_t generation; // Incremented by compactions
+	size_t len; // Number of records
+	size_t max_len; // Records kept when compacting, 0 for no limit
+};
+
+// Read-only mapping of the log
+struct mako_history_log_reader {
+	const uint8_t *log;
+	size_t log_size;
+	const uint8_t *index;
+	size_t index_size;
+	// Points into the index, or to a copy rebuilt from the log if the index
+	// can't be used
+	const uint64_t *offsets;
+	uint64_t *rebuilt_offsets;
+	size_t len;
+};
+
+// Returns $XDG_STATE_HOME/mako, or NULL.
+char *get_history_log_dir(void);
+
+struct mako_history_log *open_history_log(const char *dir, size_t max_len);
+void close_history_log(struct mako_history_log *log);
+bool append_history_log(struct mako_history_log *log,
+	const struct mako_history_record *record);
+
+bool open_history_log_reader(struct mako_history_log_reader *reader,
+	const char *dir);
+void close_history_log_reader(struct mako_history_log_reader *reader);
+// Decodes the i-th oldest record. The strings point into the mapping.
+bool read_history_log_record(const struct mako_history_log_reader *reader,
+	size_t i, struct mako_history_record *record);
+
+// Returns the string following str in mako_history_record::actions.
+const char *next_history_record_string(const char *str);
+
+#endif
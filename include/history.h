@@ -0,0 +1,66 @@
+#ifndef MAKO_HISTORY_H
+#define MAKO_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "types.h"
+
+struct mako_state;
+struct mako_notification;
+
+struct mako_history_action {
+	char *key;
+	char *title;
+};
+
+// What is kept of a closed notification: only what's needed to list it and to
+// restore it. Styles, icons and renderings are recomputed on restore.
+struct mako_history_entry {
+	uint32_t id;
+	char *app_name;
+	char *app_icon;
+	char *summary;
+	char *body;
+	char *category;
+	char *desktop_entry;
+	char *tag;
+	enum mako_notification_urgency urgency;
+	int32_t requested_timeout;
+	int32_t progress;
+	struct mako_history_action *actions;
+	size_t actions_len;
+	struct timespec closed_at; // CLOCK_REALTIME
+};
+
+// A ring buffer of the most recently closed notifications.
+struct mako_history {
+	struct mako_history_entry *entries;
+	size_t capacity;
+	size_t start; // Index of the oldest entry
+	size_t len;
+};
+
+void init_history(struct mako_history *history);
+void finish_history(struct mako_history *history);
+
+// Adds a closed notification to the history, evicting the oldest entry if
+// there are more than `max_len`. The notification itself isn't modified.
+bool push_history(struct mako_history *history, size_t max_len,
+	const struct mako_notification *notif);
+// Returns the n-th most recent entry, or NULL.
+struct mako_history_entry *get_history_entry(struct mako_history *history,
+	size_t n);
+// Removes the most recent entry and turns it back into a notification, which
+// isn't inserted into mako_state::notifications yet.
+struct mako_notification *restore_history(struct mako_state *state);
+
+// Adds a closed notification to the history, and to the persistent history if
+// it's enabled.
+void record_history(struct mako_state *state,
+	const struct mako_notification *notif);
+// Opens or closes the persistent history, according to the configuration.
+void update_history_log(struct mako_state *state);
+
+#endif
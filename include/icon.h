@@ -2,14 +2,35 @@
 #define MAKO_ICON_H
 
 #include <cairo/cairo.h>
+#include <wayland-client.h>
+#include "hash-table.h"
 #include "notification.h"
 
+// Decoded icon files, shared between notifications.
+struct mako_icon_cache {
+	struct mako_hash_table entries; // key -> struct mako_icon_cache_entry *
+	struct wl_list lru; // mako_icon_cache_entry::link, most recent first
+	size_t size; // in bytes
+};
+
+// An icon downscaled to the size it's shown at on outputs with a given scale.
+struct mako_icon_image {
+	int32_t scale;
+	cairo_surface_t *surface;
+};
+
 struct mako_icon {
-	double width;
+	struct mako_notification *notif;
+	double width; // in logical pixels
 	double height;
-	double scale;
 	int32_t border_radius;
-	cairo_surface_t *image;
+	int32_t max_icon_size;
+	// The full resolution image for image data, NULL for icon files which
+	// are loaded again instead
+	cairo_surface_t *source;
+	// struct mako_icon_image, one per scale the icon was drawn at. The first
+	// one is prepared for the highest output scale when the icon is created.
+	struct wl_array images;
 };
 
 struct mako_image_data {
@@ -19,11 +40,14 @@ struct mako_image_data {
 	uint32_t has_alpha;
 	int32_t bits_per_sample;
 	int32_t channels;
-	uint8_t *data;
+	// Borrowed from the D-Bus message, only valid while it's being handled
+	const uint8_t *data;
 };
 
 struct mako_icon *create_icon(struct mako_notification *notif);
 void destroy_icon(struct mako_icon *icon);
+void init_icons(struct mako_state *state);
+void finish_icons(struct mako_state *state);
 void draw_icon(cairo_t *cairo, struct mako_icon *icon,
 		double xpos, double ypos, double scale);
 
@@ -14,6 +14,11 @@
 
 #include "config.h"
 #include "event-loop.h"
+#include "hash-table.h"
+#include "history.h"
+#include "history-log.h"
+#include "process.h"
+#include "icon.h"
 #include "pool-buffer.h"
 #include "cursor-shape-v1-client-protocol.h"
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
@@ -42,6 +47,12 @@ struct mako_surface {
 	int32_t width, height;
 	struct pool_buffer buffers[2];
 	struct pool_buffer *current_buffer;
+	// Last frame sent to the compositor, used to compute damage
+	struct wl_array committed; // struct mako_frame_rect
+	uint32_t committed_width, committed_height;
+
+	// Placeholder used to style the "hidden notifications" indicator
+	struct mako_notification *hidden_notification;
 };
 
 struct mako_state {
@@ -50,6 +61,8 @@ struct mako_state {
 
 	sd_bus *bus;
 	sd_bus_slot *xdg_slot, *mako_slot;
+	// Pending Notifications property change, see emit_notifications_changed()
+	struct mako_idle *notifications_changed_idle;
 
 	struct wl_display *display;
 	struct wl_registry *registry;
@@ -59,6 +72,7 @@ struct mako_state {
 	struct xdg_activation_v1 *xdg_activation;
 	struct wp_cursor_shape_manager_v1 *cursor_shape_manager;
 	struct wl_list outputs; // mako_output::link
+	uint32_t outputs_serial; // Incremented when a surface changes output
 	struct wl_list seats; // mako_seat::link
 
 	struct {
@@ -73,8 +87,34 @@ struct mako_state {
 
 	uint32_t last_id;
 	struct wl_list notifications; // mako_notification::link
-	struct wl_list history; // mako_notification::link
+	// Notifications received since the last iteration of the event loop,
+	// see handle_notify()
+	struct wl_list pending_notifications; // mako_notification::pending_link
+	struct mako_idle *ingest_idle;
+	// Notifications whose timer expired, closed together once all of the
+	// timers which are due have run
+	struct wl_list expired_notifications; // mako_notification::expired_link
+	struct mako_spawner spawner; // Runs exec bindings
+	struct mako_spawn_helper spawn_helper;
+	// Indexes of state->notifications, see index_notification()
+	struct mako_hash_table notification_ids; // id -> mako_notification *
+	struct mako_hash_table notification_tags; // app_name, tag -> ditto
+	struct mako_hash_table groups; // key -> mako_notification_group *
+	struct mako_history history;
+	struct mako_history_log *history_log; // NULL if not persistent
 	struct wl_array current_modes; // char *
+	uint32_t modes_serial; // Incremented when current_modes changes
+
+	// Index of the icons in icon-path directories, see icon.c
+	struct mako_hash_table icon_dirs; // struct mako_icon_dir *
+	struct mako_icon_cache icon_cache;
+
+	struct {
+		uint64_t style_hits, style_misses;
+		uint64_t tile_hits, tile_misses;
+		uint64_t icon_hits, icon_misses;
+		uint64_t notify_calls, notify_ns; // Time spent in handle_notify()
+	} stats;
 
 	int argc;
 	char **argv;
@@ -13,21 +13,50 @@ struct mako_surface;
 struct mako_timer;
 struct mako_criteria;
 struct mako_icon;
+struct mako_tile;
+struct sd_bus_message;
 
 struct mako_hotspot {
 	int32_t x, y;
 	int32_t width, height;
 };
 
+// Everything besides the notification's own fields that criteria matching
+// depends on. The resolved style is reused for as long as this doesn't change.
+struct mako_style_key {
+	uint32_t config_serial; // mako_config::serial
+	uint32_t modes_serial; // mako_state::modes_serial
+	uint32_t outputs_serial; // mako_state::outputs_serial
+	struct mako_surface *surface;
+	int group_index;
+	bool hidden;
+};
+
+// Notifications with the same group-by spec and values for its fields.
+struct mako_notification_group {
+	char *key; // see get_group_key()
+	size_t key_len;
+	// mako_notification::group_link, in mako_state::notifications order
+	struct wl_list members;
+	size_t len;
+	bool closing; // Used by close_notifications()
+};
+
 struct mako_notification {
 	struct mako_state *state;
 	struct mako_surface *surface;
 	struct wl_list link; // mako_state::notifications
 
 	struct mako_style style;
+	struct mako_style_key style_key;
+	bool style_valid; // Whether style and style_key are up to date
+	int style_match_count;
 	struct mako_icon *icon;
+	struct mako_tile *tile; // Cached rendering, see render.c
 
 	uint32_t id;
+	struct mako_notification_group *group; // NULL if not grouped
+	struct wl_list group_link; // mako_notification_group::members
 	int group_index;
 	int group_count;
 	bool hidden;
@@ -45,6 +74,15 @@ struct mako_notification {
 	char *tag;
 	int32_t progress;
 	struct mako_image_data *image_data;
+	// Keeps the message image_data points into alive until it's ingested
+	struct sd_bus_message *image_msg;
+
+	// mako_state::pending_notifications, empty once the notification has been
+	// ingested, see handle_notify()
+	struct wl_list pending_link;
+	bool pending_replace; // Whether it replaced an existing notification
+	// mako_state::expired_notifications, see close_expired_notifications()
+	struct wl_list expired_link;
 
 	struct mako_hotspot hotspot;
 	struct mako_timer *timer;
@@ -87,13 +125,28 @@ void destroy_notification(struct mako_notification *notif);
 void close_notification(struct mako_notification *notif,
 	enum mako_notification_close_reason reason,
 	bool add_to_history);
+// Closes an array of struct mako_notification * at once. Groups are only
+// updated once, the change is only signalled once, and the affected surfaces
+// are marked dirty.
+void close_notifications(struct mako_state *state, struct wl_array *notifs,
+	enum mako_notification_close_reason reason, bool add_to_history);
 void close_group_notifications(struct mako_notification *notif,
 	enum mako_notification_close_reason reason, bool add_to_history);
 void close_all_notifications(struct mako_state *state,
 	enum mako_notification_close_reason reason, bool add_to_history);
+// Closes the notifications whose timer ran during the last pass of the event
+// loop over its timers, all at once.
+void close_expired_notifications(struct mako_state *state);
+// Adds a surface to an array of distinct struct mako_surface *, to be marked
+// dirty once a batch of changes is done.
+void add_dirty_surface(struct wl_array *surfaces, struct mako_surface *surface);
+bool notification_is_pending(const struct mako_notification *notif);
 char *format_hidden_text(char variable, bool *markup, void *data);
 char *format_notif_text(char variable, bool *markup, void *data);
 size_t format_text(const char *format, char *buf, mako_format_func_t func, void *data);
+// Adds a notification to the id and tag indexes used by get_notification()
+// and get_tagged_notification(). insert_notification() takes care of it.
+void index_notification(struct mako_notification *notif);
 struct mako_notification *get_notification(struct mako_state *state, uint32_t id);
 struct mako_notification *get_tagged_notification(struct mako_state *state, const char *tag, const char *app_name);
 size_t format_notification(struct mako_notification *notif, const char *format,
@@ -105,6 +158,6 @@ void notification_handle_touch(struct mako_notification *notif,
 void notification_execute_binding(struct mako_notification *notif,
 	const struct mako_binding *binding, const struct mako_binding_context *ctx);
 void insert_notification(struct mako_state *state, struct mako_notification *notif);
-int group_notifications(struct mako_state *state, struct mako_criteria *criteria);
+void group_notification(struct mako_notification *notif);
 
 #endif
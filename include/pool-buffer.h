@@ -7,15 +7,24 @@
 #include <stdint.h>
 #include <wayland-client.h>
 
+// Each buffer has its own shm pool, which only ever grows. Resizing the buffer
+// within the pool's capacity doesn't need a new file or mapping.
 struct pool_buffer {
 	struct wl_buffer *buffer;
 	cairo_surface_t *surface;
 	cairo_t *cairo;
 	PangoContext *pango;
 	uint32_t width, height;
+	struct wl_shm_pool *pool;
+	int fd; // Backing the pool, only valid if pool isn't NULL
 	void *data;
-	size_t size;
+	size_t size; // Capacity of the pool
 	bool busy;
+	// What has been drawn into the buffer, see render()
+	struct wl_array contents; // struct mako_frame_rect
+	// Whether the memory may hold anything, e.g. after a resize, in which
+	// case it has to be cleared entirely before drawing
+	bool undefined;
 };
 
 struct pool_buffer *get_next_buffer(struct wl_shm *shm,
@@ -0,0 +1,73 @@
+#ifndef MAKO_PROCESS_H
+#define MAKO_PROCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <wayland-client.h>
+
+struct mako_config;
+struct mako_event_loop;
+struct mako_event_source;
+struct mako_timer;
+
+// A process started by spawn_process() which hasn't exited yet
+struct mako_child {
+	struct mako_spawner *spawner;
+	struct wl_list link; // mako_spawner::children
+	pid_t pid;
+	int pidfd; // -1 if pidfds aren't supported
+	struct mako_event_source *source;
+	struct mako_timer *timer; // Terminates it, see exec-timeout
+};
+
+// A process waiting for one of the others to exit, see max-exec
+struct mako_queued_process {
+	struct wl_list link; // mako_spawner::queue
+	char **argv;
+	char **env;
+	int32_t timeout;
+};
+
+// Small process forked at startup, which spawns processes on behalf of mako,
+// see exec-helper
+struct mako_spawn_helper {
+	pid_t pid; // 0 if not running
+	int fd; // Socket to send requests to
+};
+
+// Starts processes without blocking the event loop, and reaps them once they
+// exit.
+struct mako_spawner {
+	struct mako_event_loop *event_loop;
+	const struct mako_config *config;
+	struct mako_spawn_helper *helper;
+	struct wl_list children; // mako_child::link
+	size_t children_len;
+	struct wl_list queue; // mako_queued_process::link
+	// Polls the children without a pidfd, see reap_children()
+	struct mako_timer *reap_timer;
+};
+
+void init_spawner(struct mako_spawner *spawner,
+	struct mako_event_loop *event_loop, const struct mako_config *config,
+	struct mako_spawn_helper *helper);
+// Forgets about the children, which keep running.
+void finish_spawner(struct mako_spawner *spawner);
+// Runs argv[0], searched in $PATH, with its signals reset to their defaults
+// and in a new process group. env is a NULL-terminated list of "name=value"
+// added to the environment, or NULL. If timeout is positive, the process
+// group is terminated after that many milliseconds. It's queued if max-exec
+// processes are already running, in which case the oldest queued process may
+// be dropped. argv and env are copied.
+bool spawn_process(struct mako_spawner *spawner, char *const argv[],
+	char *const env[], int32_t timeout);
+
+// Forks the helper. This should be done as early as possible, so that it
+// doesn't hold on to a copy of mako's memory.
+bool start_spawn_helper(struct mako_spawn_helper *helper);
+// Its children keep running.
+void stop_spawn_helper(struct mako_spawn_helper *helper);
+
+#endif
@@ -1,10 +1,40 @@
 #ifndef MAKO_RENDER_H
 #define MAKO_RENDER_H
 
+#include <stdint.h>
+#include <cairo/cairo.h>
+#include <wayland-client.h>
+
 struct mako_state;
 struct mako_surface;
+struct mako_icon;
+struct pool_buffer;
+
+// A notification rendered into an offscreen image, along with everything it
+// was rendered from. Dimensions are in surface-local coordinates.
+struct mako_tile {
+	cairo_surface_t *surface;
+	uint32_t serial; // Unique for the lifetime of the process
+	int width, height;
+
+	char *text;
+	uint64_t style_hash;
+	struct mako_icon *icon;
+	int scale;
+	int progress;
+	int subpixel; // enum wl_output_subpixel, or -1 if unknown
+};
+
+// A tile placed in a buffer. Dimensions are in buffer-local coordinates.
+struct mako_frame_rect {
+	int32_t x, y, width, height;
+	uint32_t tile_serial;
+};
 
 void render(struct mako_surface *surface, struct pool_buffer *buffer, int scale,
 	int *width, int *height);
+void destroy_tile(struct mako_tile *tile);
+cairo_region_t *get_frame_damage(const struct wl_array *old_frame,
+	const struct wl_array *new_frame);
 
 #endif
@@ -2,6 +2,7 @@
 #define MAKO_TYPES_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <cairo.h>
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
@@ -14,6 +15,7 @@ struct mako_color {
 bool parse_boolean(const char *string, bool *out);
 bool parse_int(const char *string, int *out);
 bool parse_int_ge(const char *string, int *out, int min);
+bool parse_size(const char *string, size_t *out);
 bool parse_color(const char *string, uint32_t *out);
 bool parse_mako_color(const char *string, struct mako_color *out);
 bool parse_anchor(const char *string, uint32_t *out);
@@ -4,6 +4,7 @@
 
 #include "config.h"
 #include "dbus.h"
+#include "icon.h"
 #include "mako.h"
 #include "mode.h"
 #include "notification.h"
@@ -47,18 +48,33 @@ static const char usage[] =
 	"      --hidden-format <format>        Format string.\n"
 	"      --max-visible <n>               Max number of visible notifications.\n"
 	"      --max-history <n>               Max size of history buffer.\n"
+	"      --icon-cache-size <size>        Memory used to cache decoded icons.\n"
+	"      --timer-slack <ms>              Round expiration times so that\n"
+	"                                      notifications expire together.\n"
+	"      --persistent-history <0|1>      Also keep history on disk.\n"
+	"      --max-persistent-history <n>    Max size of on-disk history.\n"
+	"      --max-exec <n>                  Max number of exec bindings running\n"
+	"                                      at once.\n"
+	"      --exec-helper <0|1>             Run exec bindings from a helper\n"
+	"                                      process.\n"
 	"      --history <0|1>                 Add expired notifications to history.\n"
 	"      --sort <sort_criteria>          Sorts incoming notifications by time\n"
 	"                                      and/or priority in ascending(+) or\n"
 	"                                      descending(-) order.\n"
 	"      --default-timeout <timeout>     Default timeout in milliseconds.\n"
 	"      --ignore-timeout <0|1>          Enable/disable notification timeout.\n"
+	"      --exec-timeout <ms>             Terminate exec bindings after <ms>.\n"
 	"      --output <name>                 Show notifications on this output.\n"
 	"      --layer <layer>                 Arrange notifications at this layer.\n"
 	"      --anchor <position>             Position on output to put notifications.\n"
 	"\n"
 	"Colors can be specified with the format #RRGGBB or #RRGGBBAA.\n";
 
+static void handle_timers_done(void *data) {
+	struct mako_state *state = data;
+	close_expired_notifications(state);
+}
+
 static bool init(struct mako_state *state) {
 	if (!init_dbus(state)) {
 		return false;
@@ -72,9 +88,19 @@ static bool init(struct mako_state *state) {
 		finish_wayland(state);
 		return false;
 	}
+	init_spawner(&state->spawner, &state->event_loop, &state->config,
+		&state->spawn_helper);
 	wl_list_init(&state->notifications);
-	wl_list_init(&state->history);
+	wl_list_init(&state->pending_notifications);
+	wl_list_init(&state->expired_notifications);
+	set_event_loop_timers_done(&state->event_loop, handle_timers_done, state);
+	hash_table_init(&state->notification_ids);
+	hash_table_init(&state->notification_tags);
+	hash_table_init(&state->groups);
+	init_history(&state->history);
+	update_history_log(state);
 	wl_array_init(&state->current_modes);
+	init_icons(state);
 	const char *mode = "default";
 	set_modes(state, &mode, 1);
 	return true;
@@ -91,14 +117,19 @@ static void finish(struct mako_state *state) {
 	wl_list_for_each_safe(notif, tmp, &state->notifications, link) {
 		destroy_notification(notif);
 	}
-	wl_list_for_each_safe(notif, tmp, &state->history, link) {
-		destroy_notification(notif);
-	}
+	finish_history(&state->history);
+	close_history_log(state->history_log);
+	hash_table_finish(&state->notification_ids);
+	hash_table_finish(&state->notification_tags);
+	hash_table_finish(&state->groups);
+	finish_icons(state);
 
 	struct mako_surface *surface, *stmp;
 	wl_list_for_each_safe(surface, stmp, &state->surfaces, link) {
 		destroy_surface(surface);
 	}
+	finish_spawner(&state->spawner);
+	stop_spawn_helper(&state->spawn_helper);
 	finish_event_loop(&state->event_loop);
 	finish_wayland(state);
 	finish_dbus(state);
@@ -127,7 +158,13 @@ int main(int argc, char *argv[]) {
 		return EXIT_SUCCESS;
 	}
 
+	// Before anything else is allocated, so that the helper stays small
+	if (state.config.exec_helper) {
+		start_spawn_helper(&state.spawn_helper);
+	}
+
 	if (!init(&state)) {
+		stop_spawn_helper(&state.spawn_helper);
 		finish_config(&state.config);
 		return EXIT_FAILURE;
 	}
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -15,6 +16,8 @@
 #include <basu/sd-bus.h>
 #endif
 
+#include "history-log.h"
+
 static void log_neg_errno(int ret, const char *msg, ...) {
 	va_list args;
 	va_start(args, msg);
@@ -293,6 +296,8 @@ static const char *urgency_name(uint8_t urgency) {
 }
 
 struct notification_metadata {
+	// The daemon may leave out some of the fields, see --fields
+	bool has_id, has_actions;
 	uint32_t id;
 	const char *app_name, *app_icon, *category, *desktop_entry, *summary, *body;
 	uint8_t urgency;
@@ -300,7 +305,11 @@ struct notification_metadata {
 };
 
 static void print_notification_as_text(const struct notification_metadata *notif) {
-	printf("Notification %" PRIu32 ":", notif->id);
+	if (notif->has_id) {
+		printf("Notification %" PRIu32 ":", notif->id);
+	} else {
+		printf("Notification:");
+	}
 	if (!is_empty_str(notif->summary)) {
 		printf(" %s", notif->summary);
 	}
@@ -372,43 +381,78 @@ static void print_json_str(const char *str) {
 	printf("\"");
 }
 
-static void print_json_key_value_str(const char *key, const char *value) {
-	printf("    ");
+// Notification objects are either printed over multiple lines, in lists, or
+// on a single line, in watch events.
+static void print_json_key(const char *key, bool *first, bool compact) {
+	if (!*first) {
+		printf(compact ? "," : ",\n");
+	}
+	*first = false;
+	if (!compact) {
+		printf("    ");
+	}
 	print_json_str(key);
-	printf(": ");
+	printf(compact ? ":" : ": ");
+}
+
+// Fields which weren't sent by the daemon are left out
+static void print_json_key_value_str(const char *key, const char *value,
+		bool present, bool *first, bool compact) {
+	if (!present) {
+		return;
+	}
+	print_json_key(key, first, compact);
 	print_json_str(is_empty_str(value) ? NULL : value);
-	printf(",\n");
-}
-
-static void print_notification_as_json(const struct notification_metadata *notif) {
-	printf("  {\n");
-	printf("    \"id\": %" PRIu32 ",\n", notif->id);
-	print_json_key_value_str("app_name", notif->app_name);
-	print_json_key_value_str("app_icon", notif->app_icon);
-	print_json_key_value_str("category", notif->category);
-	print_json_key_value_str("desktop_entry", notif->desktop_entry);
-	print_json_key_value_str("summary", notif->summary);
-	print_json_key_value_str("body", notif->body);
-	print_json_key_value_str("urgency", urgency_name(notif->urgency));
-	printf("    \"actions\": {");
-	if (notif->actions != NULL) {
-		bool first = true;
-		for (size_t i = 0; notif->actions[i] != NULL; i += 2) {
-			const char *key = notif->actions[i], *title = notif->actions[i + 1];
-			if (!first) {
-				printf(", ");
+}
+
+static void print_notification_as_json(const struct notification_metadata *notif,
+		bool compact) {
+	bool first = true;
+	printf(compact ? "{" : "  {\n");
+	if (notif->has_id) {
+		print_json_key("id", &first, compact);
+		printf("%" PRIu32, notif->id);
+	}
+	print_json_key_value_str("app_name", notif->app_name,
+		notif->app_name != NULL, &first, compact);
+	print_json_key_value_str("app_icon", notif->app_icon,
+		notif->app_icon != NULL, &first, compact);
+	print_json_key_value_str("category", notif->category,
+		notif->category != NULL, &first, compact);
+	print_json_key_value_str("desktop_entry", notif->desktop_entry,
+		notif->desktop_entry != NULL, &first, compact);
+	print_json_key_value_str("summary", notif->summary,
+		notif->summary != NULL, &first, compact);
+	print_json_key_value_str("body", notif->body,
+		notif->body != NULL, &first, compact);
+	// Out-of-range if it wasn't sent, see read_notification()
+	const char *urgency = urgency_name(notif->urgency);
+	print_json_key_value_str("urgency", urgency,
+		notif->urgency != (uint8_t)-1, &first, compact);
+	if (notif->has_actions) {
+		print_json_key("actions", &first, compact);
+		printf("{");
+		if (notif->actions != NULL) {
+			bool first = true;
+			for (size_t i = 0; notif->actions[i] != NULL; i += 2) {
+				const char *key = notif->actions[i], *title = notif->actions[i + 1];
+				if (!first) {
+					printf(compact ? "," : ", ");
+				}
+				first = false;
+				print_json_str(key);
+				printf(compact ? ":" : ": ");
+				print_json_str(title);
 			}
-			first = false;
-			print_json_str(key);
-			printf(": ");
-			print_json_str(title);
 		}
+		printf("}");
 	}
-	printf("}\n");
-	printf("  }");
+	printf(compact ? "}" : "\n  }");
 }
 
-static int print_notification(sd_bus_message *reply, bool json) {
+// The strings point into the message, and the actions must be freed
+static int read_notification(sd_bus_message *reply,
+		struct notification_metadata *out) {
 	struct notification_metadata notif = { .urgency = -1 };
 	while (true) {
 		int ret = sd_bus_message_enter_container(reply, 'e', "sv");
@@ -426,8 +470,10 @@ static int print_notification(sd_bus_message *reply, bool json) {
 
 		if (strcmp(key, "id") == 0) {
 			ret = sd_bus_message_read(reply, "v", "u", &notif.id);
+			notif.has_id = true;
 		} else if (strcmp(key, "actions") == 0) {
 			ret = read_actions(reply, &notif.actions);
+			notif.has_actions = true;
 		} else if (strcmp(key, "summary") == 0) {
 			ret = sd_bus_message_read(reply, "v", "s", &notif.summary);
 		} else if (strcmp(key, "body") == 0) {
@@ -455,8 +501,19 @@ static int print_notification(sd_bus_message *reply, bool json) {
 		}
 	}
 
+	*out = notif;
+	return 0;
+}
+
+static int print_notification(sd_bus_message *reply, bool json) {
+	struct notification_metadata notif;
+	int ret = read_notification(reply, &notif);
+	if (ret < 0) {
+		return ret;
+	}
+
 	if (json) {
-		print_notification_as_json(&notif);
+		print_notification_as_json(&notif, false);
 	} else {
 		print_notification_as_text(&notif);
 	}
@@ -465,23 +522,7 @@ static int print_notification(sd_bus_message *reply, bool json) {
 	return 0;
 }
 
-static int print_notification_list(sd_bus_message *reply, int argc, char *argv[]) {
-	bool json = false;
-	while (true) {
-		int opt = getopt(argc, argv, "j");
-		if (opt == -1) {
-			break;
-		}
-
-		switch (opt) {
-		case 'j':
-			json = true;
-			break;
-		default:
-			return -EINVAL;
-		}
-	}
-
+static int print_notification_list(sd_bus_message *reply, bool json) {
 	int ret = sd_bus_message_enter_container(reply, 'a', "a{sv}");
 	if (ret < 0) {
 		return ret;
@@ -526,30 +567,638 @@ static int print_notification_list(sd_bus_message *reply, int argc, char *argv[]
 	return sd_bus_message_exit_container(reply);
 }
 
-static int run_history(sd_bus *bus, int argc, char *argv[]) {
+struct list_options {
+	bool json;
+	const char *filter; // criteria
+	uint32_t id; // 0 for any notification
+	uint32_t limit; // 0 for no limit
+	const char *fields; // comma-separated
+	bool persistent; // Read the persistent history instead of asking mako
+};
+
+static int parse_list_options(struct list_options *opts, int argc, char *argv[]) {
+	while (true) {
+		const struct option options[] = {
+			{ "filter", required_argument, 0, 'f' },
+			{ "limit", required_argument, 0, 'l' },
+			{ "fields", required_argument, 0, 'F' },
+			{ "persistent", no_argument, 0, 'p' },
+			{0},
+		};
+		int opt = getopt_long(argc, argv, "jf:l:F:p", options, NULL);
+		if (opt == -1) {
+			break;
+		}
+
+		switch (opt) {
+		case 'j':
+			opts->json = true;
+			break;
+		case 'f':
+			opts->filter = optarg;
+			break;
+		case 'l':;
+			int ret = parse_uint32(&opts->limit, optarg);
+			if (ret < 0) {
+				log_neg_errno(ret, "invalid limit");
+				return ret;
+			}
+			break;
+		case 'F':
+			opts->fields = optarg;
+			break;
+		case 'p':
+			opts->persistent = true;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static int append_query_fields(sd_bus_message *msg, const char *fields) {
+	int ret = sd_bus_message_open_container(msg, 'e', "sv");
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_append_basic(msg, 's', "fields");
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_open_container(msg, 'v', "as");
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_open_container(msg, 'a', "s");
+	if (ret < 0) {
+		return ret;
+	}
+
+	char *names = strdup(fields);
+	if (names == NULL) {
+		return -ENOMEM;
+	}
+	char *name = names;
+	while (name != NULL) {
+		char *next = strchr(name, ',');
+		if (next != NULL) {
+			*next = '\0';
+			++next;
+		}
+		if (name[0] != '\0') {
+			ret = sd_bus_message_append_basic(msg, 's', name);
+			if (ret < 0) {
+				free(names);
+				return ret;
+			}
+		}
+		name = next;
+	}
+	free(names);
+
+	for (int i = 0; i < 3; ++i) {
+		ret = sd_bus_message_close_container(msg);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+// Lets the daemon do the filtering, so that only the requested notifications
+// and fields are sent over the bus
+static int query_notifications(sd_bus *bus, const char *member,
+		const struct list_options *opts, sd_bus_message **reply) {
+	sd_bus_message *msg = NULL;
+	int ret = new_method_call(bus, &msg, member);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_open_container(msg, 'a', "{sv}");
+	if (ret < 0) {
+		goto out;
+	}
+
+	if (opts->filter != NULL) {
+		ret = sd_bus_message_append(msg, "{sv}", "criteria", "s", opts->filter);
+		if (ret < 0) {
+			goto out;
+		}
+	}
+
+	if (opts->id != 0) {
+		ret = sd_bus_message_append(msg, "{sv}", "id", "u", opts->id);
+		if (ret < 0) {
+			goto out;
+		}
+	}
+
+	if (opts->limit != 0) {
+		ret = sd_bus_message_append(msg, "{sv}", "limit", "u", opts->limit);
+		if (ret < 0) {
+			goto out;
+		}
+	}
+
+	if (opts->fields != NULL) {
+		ret = append_query_fields(msg, opts->fields);
+		if (ret < 0) {
+			goto out;
+		}
+	}
+
+	ret = sd_bus_message_close_container(msg);
+	if (ret < 0) {
+		goto out;
+	}
+
+	ret = call(bus, msg, reply);
+
+out:
+	sd_bus_message_unref(msg);
+	return ret;
+}
+
+static int run_query(sd_bus *bus, const char *member,
+		const struct list_options *opts) {
 	sd_bus_message *reply = NULL;
-	int ret = call_method(bus, "ListHistory", &reply, "");
+	int ret = query_notifications(bus, member, opts, &reply);
 	if (ret < 0) {
 		return ret;
 	}
 
-	ret = print_notification_list(reply, argc, argv);
+	ret = print_notification_list(reply, opts->json);
 	sd_bus_message_unref(reply);
 	return ret;
 }
 
+// Reads the log written by mako directly, so that it works even if mako isn't
+// running. Criteria are only understood by mako, so there's no filtering.
+static int print_persistent_history(const struct list_options *opts) {
+	if (opts->filter != NULL || opts->fields != NULL) {
+		fprintf(stderr, "--filter and --fields can't be used with --persistent\n");
+		return -EINVAL;
+	}
+
+	char *dir = get_history_log_dir();
+	if (dir == NULL) {
+		return -ENOENT;
+	}
+	struct mako_history_log_reader reader;
+	bool ok = open_history_log_reader(&reader, dir);
+	free(dir);
+	if (!ok) {
+		return -EIO;
+	}
+
+	size_t len = reader.len;
+	if (opts->limit != 0 && opts->limit < len) {
+		len = opts->limit;
+	}
+
+	int ret = 0;
+	if (opts->json) {
+		printf("[");
+	}
+	for (size_t i = 0; i < len; ++i) {
+		struct mako_history_record record;
+		if (!read_history_log_record(&reader, reader.len - 1 - i, &record)) {
+			fprintf(stderr, "Persistent history is corrupted\n");
+			ret = -EIO;
+			break;
+		}
+
+		// The actions aren't copied, only the array pointing to them
+		char **actions = NULL;
+		if (record.actions_len > 0) {
+			actions = calloc(2 * record.actions_len + 1, sizeof(char *));
+			if (actions == NULL) {
+				ret = -ENOMEM;
+				break;
+			}
+			const char *str = record.actions;
+			for (size_t j = 0; j < 2 * record.actions_len; ++j) {
+				actions[j] = (char *)str;
+				str = next_history_record_string(str);
+			}
+		}
+
+		struct notification_metadata notif = {
+			.has_id = true,
+			.has_actions = true,
+			.id = record.id,
+			.app_name = record.app_name,
+			.app_icon = record.app_icon,
+			.category = record.category,
+			.desktop_entry = record.desktop_entry,
+			.summary = record.summary,
+			.body = record.body,
+			.urgency = record.urgency,
+			.actions = actions,
+		};
+		if (opts->json) {
+			printf(i > 0 ? ",\n" : "\n");
+			print_notification_as_json(&notif, false);
+		} else {
+			print_notification_as_text(&notif);
+		}
+		free(actions);
+	}
+	if (opts->json) {
+		printf("\n]\n");
+	}
+
+	close_history_log_reader(&reader);
+	return ret;
+}
+
+static int run_history(sd_bus *bus, int argc, char *argv[]) {
+	struct list_options opts = {0};
+	int ret = parse_list_options(&opts, argc, argv);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (opts.persistent) {
+		return print_persistent_history(&opts);
+	}
+	return run_query(bus, "QueryHistory", &opts);
+}
+
 static int run_list(sd_bus *bus, int argc, char *argv[]) {
+	struct list_options opts = {0};
+	int ret = parse_list_options(&opts, argc, argv);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (opts.persistent) {
+		fprintf(stderr, "--persistent can only be used with history\n");
+		return -EINVAL;
+	}
+	return run_query(bus, "QueryNotifications", &opts);
+}
+
+struct watch_state {
+	sd_bus *bus;
+	bool json;
+	const char *filter;
+	// Notifications matching the filter, so that their removal and their
+	// actions can be reported too
+	uint32_t *ids;
+	size_t ids_len, ids_cap;
+};
+
+static bool is_watched_id(struct watch_state *watch, uint32_t id) {
+	if (watch->filter == NULL) {
+		return true;
+	}
+	for (size_t i = 0; i < watch->ids_len; i++) {
+		if (watch->ids[i] == id) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void remove_watched_id(struct watch_state *watch, uint32_t id) {
+	for (size_t i = 0; i < watch->ids_len; i++) {
+		if (watch->ids[i] == id) {
+			watch->ids[i] = watch->ids[--watch->ids_len];
+			return;
+		}
+	}
+}
+
+static int add_watched_id(struct watch_state *watch, uint32_t id) {
+	if (is_watched_id(watch, id)) {
+		return 0;
+	}
+	if (watch->ids_len == watch->ids_cap) {
+		size_t cap = watch->ids_cap == 0 ? 32 : 2 * watch->ids_cap;
+		uint32_t *ids = realloc(watch->ids, cap * sizeof(uint32_t));
+		if (ids == NULL) {
+			return -ENOMEM;
+		}
+		watch->ids = ids;
+		watch->ids_cap = cap;
+	}
+	watch->ids[watch->ids_len++] = id;
+	return 0;
+}
+
+// Asks the daemon which notifications match the filter. If id is non-zero,
+// only that notification is checked.
+static int watch_matching(struct watch_state *watch, uint32_t id) {
+	struct list_options opts = {
+		.filter = watch->filter,
+		.id = id,
+		.fields = "id",
+	};
 	sd_bus_message *reply = NULL;
-	int ret = call_method(bus, "ListNotifications", &reply, "");
+	int ret = query_notifications(watch->bus, "QueryNotifications", &opts,
+		&reply);
 	if (ret < 0) {
 		return ret;
 	}
 
-	ret = print_notification_list(reply, argc, argv);
+	ret = sd_bus_message_enter_container(reply, 'a', "a{sv}");
+	while (ret >= 0) {
+		ret = sd_bus_message_enter_container(reply, 'a', "{sv}");
+		if (ret <= 0) {
+			break;
+		}
+
+		struct notification_metadata notif;
+		ret = read_notification(reply, &notif);
+		if (ret < 0) {
+			break;
+		}
+		free_strv(notif.actions);
+		ret = add_watched_id(watch, notif.id);
+		if (ret < 0) {
+			break;
+		}
+
+		ret = sd_bus_message_exit_container(reply);
+	}
+
 	sd_bus_message_unref(reply);
 	return ret;
 }
 
+static const char *close_reason_name(uint32_t reason) {
+	switch (reason) {
+	case 1:
+		return "expired";
+	case 2:
+		return "dismissed";
+	case 3:
+		return "request";
+	}
+	return "undefined";
+}
+
+static int handle_notification_changed(sd_bus_message *msg,
+		struct watch_state *watch, const char *event, const char *label) {
+	int ret = sd_bus_message_enter_container(msg, 'a', "{sv}");
+	if (ret < 0) {
+		return ret;
+	}
+
+	struct notification_metadata notif;
+	ret = read_notification(msg, &notif);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (watch->filter != NULL) {
+		// An updated notification may not match anymore
+		remove_watched_id(watch, notif.id);
+		ret = watch_matching(watch, notif.id);
+		if (ret < 0 || !is_watched_id(watch, notif.id)) {
+			free_strv(notif.actions);
+			return ret;
+		}
+	}
+
+	if (watch->json) {
+		printf("{\"event\":");
+		print_json_str(event);
+		printf(",\"notification\":");
+		print_notification_as_json(&notif, true);
+		printf("}\n");
+	} else {
+		printf("%s: ", label);
+		print_notification_as_text(&notif);
+	}
+	fflush(stdout);
+
+	free_strv(notif.actions);
+	return 0;
+}
+
+static int handle_notification_added(sd_bus_message *msg, void *data,
+		sd_bus_error *ret_error) {
+	return handle_notification_changed(msg, data, "added", "Added");
+}
+
+static int handle_notification_updated(sd_bus_message *msg, void *data,
+		sd_bus_error *ret_error) {
+	return handle_notification_changed(msg, data, "updated", "Updated");
+}
+
+static int handle_notification_removed(sd_bus_message *msg, void *data,
+		sd_bus_error *ret_error) {
+	struct watch_state *watch = data;
+
+	uint32_t id, reason;
+	int ret = sd_bus_message_read(msg, "uu", &id, &reason);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (!is_watched_id(watch, id)) {
+		return 0;
+	}
+	remove_watched_id(watch, id);
+
+	if (watch->json) {
+		printf("{\"event\":\"removed\",\"id\":%" PRIu32 ",\"reason\":", id);
+		print_json_str(close_reason_name(reason));
+		printf("}\n");
+	} else {
+		printf("Removed: Notification %" PRIu32 " (%s)\n", id,
+			close_reason_name(reason));
+	}
+	fflush(stdout);
+	return 0;
+}
+
+static int handle_action_invoked(sd_bus_message *msg, void *data,
+		sd_bus_error *ret_error) {
+	struct watch_state *watch = data;
+
+	uint32_t id;
+	const char *action;
+	int ret = sd_bus_message_read(msg, "us", &id, &action);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (!is_watched_id(watch, id)) {
+		return 0;
+	}
+
+	if (watch->json) {
+		printf("{\"event\":\"action-invoked\",\"id\":%" PRIu32 ",\"action\":", id);
+		print_json_str(action);
+		printf("}\n");
+	} else {
+		printf("Action invoked: Notification %" PRIu32 ": %s\n", id, action);
+	}
+	fflush(stdout);
+	return 0;
+}
+
+static int print_modes_event(struct watch_state *watch) {
+	sd_bus_message *reply = NULL;
+	int ret = call_method(watch->bus, "ListModes", &reply, "");
+	if (ret < 0) {
+		return ret;
+	}
+
+	char **modes = NULL;
+	ret = sd_bus_message_read_strv(reply, &modes);
+	sd_bus_message_unref(reply);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (watch->json) {
+		printf("{\"event\":\"modes\",\"modes\":[");
+	} else {
+		printf("Modes:");
+	}
+	for (size_t i = 0; modes != NULL && modes[i] != NULL; i++) {
+		if (watch->json) {
+			if (i > 0) {
+				printf(",");
+			}
+			print_json_str(modes[i]);
+		} else {
+			printf(" %s", modes[i]);
+		}
+	}
+	printf(watch->json ? "]}\n" : "\n");
+	fflush(stdout);
+
+	free_strv(modes);
+	return 0;
+}
+
+// The Modes property only emits invalidations, so fetch the new value
+static int handle_properties_changed(sd_bus_message *msg, void *data,
+		sd_bus_error *ret_error) {
+	struct watch_state *watch = data;
+
+	const char *interface;
+	int ret = sd_bus_message_read(msg, "s", &interface);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = sd_bus_message_skip(msg, "a{sv}");
+	if (ret < 0) {
+		return ret;
+	}
+
+	char **invalidated = NULL;
+	ret = sd_bus_message_read_strv(msg, &invalidated);
+	if (ret < 0) {
+		return ret;
+	}
+
+	bool modes_changed = false;
+	for (size_t i = 0; invalidated != NULL && invalidated[i] != NULL; i++) {
+		if (strcmp(invalidated[i], "Modes") == 0) {
+			modes_changed = true;
+		}
+	}
+	free_strv(invalidated);
+
+	if (!modes_changed) {
+		return 0;
+	}
+	return print_modes_event(watch);
+}
+
+static int run_watch(sd_bus *bus, int argc, char *argv[]) {
+	struct watch_state watch = { .bus = bus };
+	while (true) {
+		const struct option options[] = {
+			{ "json", no_argument, 0, 'j' },
+			{ "filter", required_argument, 0, 'f' },
+			{0},
+		};
+		int opt = getopt_long(argc, argv, "jf:", options, NULL);
+		if (opt == -1) {
+			break;
+		}
+
+		switch (opt) {
+		case 'j':
+			watch.json = true;
+			break;
+		case 'f':
+			watch.filter = optarg;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	const struct {
+		const char *path, *interface, *member;
+		sd_bus_message_handler_t handler;
+	} matches[] = {
+		{ "/fr/emersion/Mako", "fr.emersion.Mako", "NotificationAdded",
+			handle_notification_added },
+		{ "/fr/emersion/Mako", "fr.emersion.Mako", "NotificationUpdated",
+			handle_notification_updated },
+		{ "/fr/emersion/Mako", "fr.emersion.Mako", "NotificationRemoved",
+			handle_notification_removed },
+		{ "/org/freedesktop/Notifications", "org.freedesktop.Notifications",
+			"ActionInvoked", handle_action_invoked },
+		{ "/fr/emersion/Mako", "org.freedesktop.DBus.Properties",
+			"PropertiesChanged", handle_properties_changed },
+	};
+	int ret = 0;
+	for (size_t i = 0; i < sizeof(matches) / sizeof(matches[0]); i++) {
+		ret = sd_bus_match_signal(bus, NULL, "org.freedesktop.Notifications",
+			matches[i].path, matches[i].interface, matches[i].member,
+			matches[i].handler, &watch);
+		if (ret < 0) {
+			log_neg_errno(ret, "sd_bus_match_signal() failed");
+			goto out;
+		}
+	}
+
+	// Subscribe before looking at the current notifications, so that none
+	// of them can be missed
+	if (watch.filter != NULL) {
+		ret = watch_matching(&watch, 0);
+		if (ret < 0) {
+			goto out;
+		}
+	}
+
+	while (true) {
+		ret = sd_bus_process(bus, NULL);
+		if (ret < 0) {
+			log_neg_errno(ret, "sd_bus_process() failed");
+			break;
+		} else if (ret > 0) {
+			continue;
+		}
+
+		ret = sd_bus_wait(bus, UINT64_MAX);
+		if (ret < 0 && ret != -EINTR) {
+			log_neg_errno(ret, "sd_bus_wait() failed");
+			break;
+		}
+	}
+
+out:
+	free(watch.ids);
+	return ret;
+}
+
 static int exec_menu(char *argv[], FILE **in, FILE **out, pid_t *pid_ptr) {
 	int in_pipe[2], out_pipe[2];
 	if (pipe(in_pipe) != 0 || pipe(out_pipe) != 0) {
@@ -931,7 +1580,14 @@ static const char usage[] =
 	"                                 with the given id, or the last\n"
 	"                                 notification if none is given\n"
 	"  list [-j]                      List notifications\n"
-	"  history [-j]                   List history\n"
+	"       [-f|--filter criteria]    Only list matching notifications\n"
+	"       [-l|--limit n]            List at most n notifications\n"
+	"       [-F|--fields f1,f2,...]   Only print the given fields\n"
+	"  history [-j] [-f criteria]     List history, most recent first.\n"
+	"          [-l n] [-F fields]     Options are the same as for list\n"
+	"          [-p|--persistent]      Read the persistent history instead\n"
+	"  watch [-j] [-f criteria]       Print notification and mode changes\n"
+	"                                 as they happen\n"
 	"  reload                         Reload the configuration file\n"
 	"  mode                           List modes\n"
 	"  mode [-a mode]... [-r mode]... Add/remove modes\n"
@@ -971,6 +1627,8 @@ int main(int argc, char *argv[]) {
 		ret = run_list(bus, cmd_argc, cmd_argv);
 	} else if (strcmp(cmd, "menu") == 0) {
 		ret = run_menu(bus, cmd_argc, cmd_argv);
+	} else if (strcmp(cmd, "watch") == 0) {
+		ret = run_watch(bus, cmd_argc, cmd_argv);
 	} else if (strcmp(cmd, "mode") == 0) {
 		ret = run_mode(bus, cmd_argc, cmd_argv);
 	} else if (strcmp(cmd, "reload") == 0) {
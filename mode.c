@@ -39,6 +39,7 @@ void set_modes(struct mako_state *state, const char **modes, size_t modes_len) {
 		char **dst = wl_array_add(&state->current_modes, sizeof(char *));
 		*dst = strdup(modes[i]);
 	}
+	++state->modes_serial;
 
 	emit_modes_changed(state);
 }
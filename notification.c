@@ -3,8 +3,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
-#include <unistd.h>
 
 #include <pango/pangocairo.h>
 #include <wayland-client.h>
@@ -17,6 +15,7 @@
 #include "mako.h"
 #include "notification.h"
 #include "icon.h"
+#include "render.h"
 #include "string-util.h"
 #include "wayland.h"
 
@@ -27,7 +26,272 @@ bool hotspot_at(struct mako_hotspot *hotspot, int32_t x, int32_t y) {
 		y < hotspot->y + hotspot->height;
 }
 
+// The tag key is the app name and the tag, separated by a NUL byte. Returns
+// NULL if the notification has no tag.
+static char *get_tag_key(const char *app_name, const char *tag,
+		size_t *key_len) {
+	if (tag == NULL || tag[0] == '\0') {
+		return NULL;
+	}
+	size_t app_name_len = strlen(app_name);
+	size_t tag_len = strlen(tag);
+	*key_len = app_name_len + 1 + tag_len;
+	char *key = malloc(*key_len);
+	if (key == NULL) {
+		return NULL;
+	}
+	memcpy(key, app_name, app_name_len + 1);
+	memcpy(key + app_name_len + 1, tag, tag_len);
+	return key;
+}
+
+void index_notification(struct mako_notification *notif) {
+	struct mako_state *state = notif->state;
+	if (!hash_table_set(&state->notification_ids, &notif->id,
+			sizeof(notif->id), notif)) {
+		fprintf(stderr, "allocation failed\n");
+	}
+
+	size_t key_len;
+	char *key = get_tag_key(notif->app_name, notif->tag, &key_len);
+	if (key != NULL) {
+		if (!hash_table_set(&state->notification_tags, key, key_len, notif)) {
+			fprintf(stderr, "allocation failed\n");
+		}
+		free(key);
+	}
+}
+
+// Removes the notification from the indexes, if it's there. Safe to call on
+// notifications which were never indexed.
+static void unindex_notification(struct mako_notification *notif) {
+	struct mako_state *state = notif->state;
+	if (hash_table_get(&state->notification_ids, &notif->id,
+			sizeof(notif->id)) == notif) {
+		hash_table_remove(&state->notification_ids, &notif->id,
+			sizeof(notif->id));
+	}
+
+	size_t key_len;
+	char *key = get_tag_key(notif->app_name, notif->tag, &key_len);
+	if (key != NULL) {
+		if (hash_table_get(&state->notification_tags, key, key_len) == notif) {
+			hash_table_remove(&state->notification_tags, key, key_len);
+		}
+		free(key);
+	}
+}
+
+static bool append_bytes(struct wl_array *array, const void *data,
+		size_t size) {
+	void *dst = wl_array_add(array, size);
+	if (dst == NULL) {
+		return false;
+	}
+	memcpy(dst, data, size);
+	return true;
+}
+
+// The group key identifies the notifications which are grouped together: it's
+// made of the group-by spec and the values of the fields it selects. Returns
+// NULL if the notification isn't grouped.
+static char *get_group_key(struct mako_notification *notif, size_t *key_len) {
+	const struct mako_criteria_spec *spec = &notif->style.group_criteria_spec;
+	if (spec->none) {
+		return NULL;
+	}
+
+	struct wl_array key;
+	wl_array_init(&key);
+	bool ok = append_bytes(&key, spec, sizeof(*spec));
+
+	const char *strings[] = {
+		spec->app_name ? notif->app_name : NULL,
+		spec->app_icon ? notif->app_icon : NULL,
+		spec->category ? notif->category : NULL,
+		spec->desktop_entry ? notif->desktop_entry : NULL,
+		spec->summary ? notif->summary : NULL,
+		spec->body ? notif->body : NULL,
+	};
+	for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); ++i) {
+		if (strings[i] != NULL) {
+			// Include the terminating NUL, to keep fields apart
+			ok = ok && append_bytes(&key, strings[i], strlen(strings[i]) + 1);
+		}
+	}
+
+	struct {
+		bool actionable;
+		bool expiring;
+		int32_t urgency;
+	} values;
+	memset(&values, 0, sizeof(values));
+	values.actionable = spec->actionable && !wl_list_empty(&notif->actions);
+	values.expiring = spec->expiring && notif->requested_timeout != 0;
+	values.urgency = spec->urgency ? (int32_t)notif->urgency : 0;
+	ok = ok && append_bytes(&key, &values, sizeof(values));
+
+	if (!ok) {
+		fprintf(stderr, "allocation failed\n");
+		wl_array_release(&key);
+		return NULL;
+	}
+	*key_len = key.size;
+	return key.data;
+}
+
+// Updates the index and count of all the notifications in a group, in the
+// order they appear in mako_state::notifications.
+static void renumber_group(struct mako_notification_group *group) {
+	int index = 0;
+	struct mako_notification *notif;
+	wl_list_for_each(notif, &group->members, group_link) {
+		// A notification which doesn't have any others to group with is
+		// ungrouped just as if it had no grouping criteria.
+		notif->group_index = group->len > 1 ? index++ : -1;
+		notif->group_count = group->len;
+	}
+}
+
+static void destroy_group(struct mako_state *state,
+		struct mako_notification_group *group) {
+	hash_table_remove(&state->groups, group->key, group->key_len);
+	free(group->key);
+	free(group);
+}
+
+// Takes a notification out of its group without updating the remaining
+// members. Returns the group it was part of.
+static struct mako_notification_group *remove_from_group(
+		struct mako_notification *notif) {
+	struct mako_notification_group *group = notif->group;
+	if (group == NULL) {
+		return NULL;
+	}
+	wl_list_remove(&notif->group_link);
+	wl_list_init(&notif->group_link);
+	--group->len;
+	notif->group = NULL;
+	notif->group_index = -1;
+	return group;
+}
+
+// Updates the remaining members of a group after notifications were removed.
+static void finish_group_removal(struct mako_state *state,
+		struct mako_notification_group *group) {
+	if (group->len == 0) {
+		destroy_group(state, group);
+	} else {
+		renumber_group(group);
+	}
+}
+
+static void leave_group(struct mako_notification *notif) {
+	struct mako_notification_group *group = remove_from_group(notif);
+	if (group != NULL) {
+		finish_group_removal(notif->state, group);
+	}
+}
+
+// Whether the members of `group` come before `notif` in
+// mako_state::notifications. Looks in both directions at once, so this is
+// cheap when notif is close to either the group or an end of the list.
+static bool is_group_before(struct mako_state *state,
+		struct mako_notification_group *group,
+		struct mako_notification *notif) {
+	struct wl_list *head = &state->notifications;
+	struct wl_list *back = notif->link.prev, *forward = notif->link.next;
+	while (true) {
+		if (back == head) {
+			return false;
+		}
+		if (forward == head) {
+			return true;
+		}
+		struct mako_notification *prev = wl_container_of(back, prev, link);
+		if (prev->group == group) {
+			return true;
+		}
+		struct mako_notification *next = wl_container_of(forward, next, link);
+		if (next->group == group) {
+			return false;
+		}
+		back = back->prev;
+		forward = forward->next;
+	}
+}
+
+// Puts a notification in the group matching its group-by spec, if it isn't
+// already. Group members are kept next to each other in
+// mako_state::notifications: a notification joining a group is moved to the
+// end of the group if it comes after it, otherwise the group is moved right
+// after the notification.
+void group_notification(struct mako_notification *notif) {
+	struct mako_state *state = notif->state;
+
+	size_t key_len = 0;
+	char *key = get_group_key(notif, &key_len);
+	if (notif->group != NULL && key != NULL &&
+			notif->group->key_len == key_len &&
+			memcmp(notif->group->key, key, key_len) == 0) {
+		free(key);
+		return;
+	}
+
+	leave_group(notif);
+	if (key == NULL) {
+		return;
+	}
+
+	struct mako_notification_group *group =
+		hash_table_get(&state->groups, key, key_len);
+	if (group == NULL) {
+		group = calloc(1, sizeof(struct mako_notification_group));
+		if (group == NULL ||
+				!hash_table_set(&state->groups, key, key_len, group)) {
+			fprintf(stderr, "allocation failed\n");
+			free(group);
+			free(key);
+			return;
+		}
+		group->key = key;
+		group->key_len = key_len;
+		wl_list_init(&group->members);
+	} else {
+		free(key);
+	}
+
+	if (group->len == 0) {
+		wl_list_insert(&group->members, &notif->group_link);
+	} else if (is_group_before(state, group, notif)) {
+		struct mako_notification *last =
+			wl_container_of(group->members.prev, last, group_link);
+		wl_list_remove(&notif->link);
+		wl_list_insert(&last->link, &notif->link);
+		wl_list_insert(group->members.prev, &notif->group_link);
+	} else {
+		struct wl_list *location = &notif->link;
+		struct mako_notification *member;
+		wl_list_for_each(member, &group->members, group_link) {
+			wl_list_remove(&member->link);
+			wl_list_insert(location, &member->link);
+			location = &member->link;
+		}
+		wl_list_insert(&group->members, &notif->group_link);
+	}
+	notif->group = group;
+	++group->len;
+
+	// We don't actually re-apply criteria here, that will happen just before
+	// we render each notification anyway.
+	renumber_group(group);
+}
+
 void reset_notification(struct mako_notification *notif) {
+	// The app name and tag are about to change
+	unindex_notification(notif);
+	leave_group(notif);
+
 	struct mako_action *action, *tmp;
 	wl_list_for_each_safe(action, tmp, &notif->actions, link) {
 		wl_list_remove(&action->link);
@@ -38,9 +302,12 @@ void reset_notification(struct mako_notification *notif) {
 
 	notif->urgency = MAKO_NOTIFICATION_URGENCY_UNKNOWN;
 	notif->progress = -1;
+	notif->style_valid = false;
 
 	destroy_timer(notif->timer);
 	notif->timer = NULL;
+	wl_list_remove(&notif->expired_link);
+	wl_list_init(&notif->expired_link);
 
 	free(notif->app_name);
 	free(notif->app_icon);
@@ -49,10 +316,9 @@ void reset_notification(struct mako_notification *notif) {
 	free(notif->category);
 	free(notif->desktop_entry);
 	free(notif->tag);
-	if (notif->image_data != NULL) {
-		free(notif->image_data->data);
-		free(notif->image_data);
-	}
+	free(notif->image_data);
+	sd_bus_message_unref(notif->image_msg);
+	notif->image_msg = NULL;
 
 	notif->app_name = strdup("");
 	notif->app_icon = strdup("");
@@ -66,6 +332,9 @@ void reset_notification(struct mako_notification *notif) {
 
 	destroy_icon(notif->icon);
 	notif->icon = NULL;
+
+	destroy_tile(notif->tile);
+	notif->tile = NULL;
 }
 
 struct mako_notification *create_notification(struct mako_state *state) {
@@ -81,6 +350,9 @@ struct mako_notification *create_notification(struct mako_state *state) {
 	notif->id = state->last_id;
 	wl_list_init(&notif->actions);
 	wl_list_init(&notif->link);
+	wl_list_init(&notif->group_link);
+	wl_list_init(&notif->pending_link);
+	wl_list_init(&notif->expired_link);
 	reset_notification(notif);
 
 	// Start ungrouped.
@@ -91,6 +363,7 @@ struct mako_notification *create_notification(struct mako_state *state) {
 
 void destroy_notification(struct mako_notification *notif) {
 	wl_list_remove(&notif->link);
+	wl_list_remove(&notif->pending_link);
 
 	reset_notification(notif);
 
@@ -106,68 +379,137 @@ void destroy_notification(struct mako_notification *notif) {
 	free(notif);
 }
 
+// Records a closed notification, which has already been unlinked and
+// regrouped, in the history if needed and destroys it.
+static void retire_notification(struct mako_notification *notif,
+		bool add_to_history) {
+	struct mako_state *state = notif->state;
+
+	if (add_to_history && notif->style.history) {
+		record_history(state, notif);
+	}
+	destroy_notification(notif);
+}
+
 void close_notification(struct mako_notification *notif,
 		enum mako_notification_close_reason reason,
 		bool add_to_history) {
 	struct mako_state *state = notif->state;
 
 	notify_notification_closed(notif, reason);
+	// Subscribers only hear about it once it's ingested
+	if (!notification_is_pending(notif)) {
+		emit_notification_removed(notif, reason);
+	}
+	unindex_notification(notif);
 	wl_list_remove(&notif->link);  // Remove so regrouping works...
 	wl_list_init(&notif->link);  // ...but destroy will remove again.
 
-	struct mako_criteria *notif_criteria = create_criteria_from_notification(
-			notif, &notif->style.group_criteria_spec);
-	if (notif_criteria) {
-		group_notifications(state, notif_criteria);
-		destroy_criteria(notif_criteria);
-	}
+	leave_group(notif);
 
-	if (!notif->style.history ||
-		state->config.max_history <= 0) {
-		destroy_notification(notif);
+	retire_notification(notif, add_to_history);
+
+	emit_notifications_changed(state);
+}
+
+bool notification_is_pending(const struct mako_notification *notif) {
+	return !wl_list_empty(&notif->pending_link);
+}
+
+// There are only ever a few surfaces, so a linear search is fine.
+void add_dirty_surface(struct wl_array *surfaces,
+		struct mako_surface *surface) {
+	if (surface == NULL) {
 		return;
 	}
+	struct mako_surface **surface_ptr;
+	wl_array_for_each(surface_ptr, surfaces) {
+		if (*surface_ptr == surface) {
+			return;
+		}
+	}
+	surface_ptr = wl_array_add(surfaces, sizeof(struct mako_surface *));
+	if (surface_ptr == NULL) {
+		// Redraw it right away instead
+		set_dirty(surface);
+		return;
+	}
+	*surface_ptr = surface;
+}
 
-	destroy_timer(notif->timer);
-	notif->timer = NULL;
+void close_notifications(struct mako_state *state, struct wl_array *notifs,
+		enum mako_notification_close_reason reason,
+		bool add_to_history) {
+	// Unlink all of the notifications first, and collect the groups they
+	// were part of and the surfaces they were shown on, so that each group is
+	// only updated once and each surface only redrawn once.
+	struct wl_array groups; // struct mako_notification_group *
+	wl_array_init(&groups);
+	struct wl_array surfaces; // struct mako_surface *
+	wl_array_init(&surfaces);
+
+	struct mako_notification **notif_ptr;
+	wl_array_for_each(notif_ptr, notifs) {
+		struct mako_notification *notif = *notif_ptr;
+		add_dirty_surface(&surfaces, notif->surface);
+		notify_notification_closed(notif, reason);
+		if (!notification_is_pending(notif)) {
+			emit_notification_removed(notif, reason);
+		}
+		unindex_notification(notif);
+		wl_list_remove(&notif->link);
+		wl_list_init(&notif->link);
 
-	if (add_to_history) {
-		notif->surface = NULL;
-		wl_list_insert(&state->history, &notif->link);
-		while (wl_list_length(&state->history) > state->config.max_history) {
-			struct mako_notification *n =
-				wl_container_of(state->history.prev, n, link);
-			destroy_notification(n);
+		struct mako_notification_group *group = remove_from_group(notif);
+		if (group == NULL || group->closing) {
+			continue;
 		}
-	} else {
-		destroy_notification(notif);
+		struct mako_notification_group **group_ptr =
+			wl_array_add(&groups, sizeof(struct mako_notification_group *));
+		if (group_ptr == NULL) {
+			finish_group_removal(state, group);
+			continue;
+		}
+		*group_ptr = group;
+		group->closing = true;
+	}
+
+	struct mako_notification_group **group_ptr;
+	wl_array_for_each(group_ptr, &groups) {
+		(*group_ptr)->closing = false;
+		finish_group_removal(state, *group_ptr);
+	}
+	wl_array_release(&groups);
+
+	wl_array_for_each(notif_ptr, notifs) {
+		retire_notification(*notif_ptr, add_to_history);
 	}
 
 	emit_notifications_changed(state);
+
+	struct mako_surface **surface_ptr;
+	wl_array_for_each(surface_ptr, &surfaces) {
+		set_dirty(*surface_ptr);
+	}
+	wl_array_release(&surfaces);
 }
 
 struct mako_notification *get_notification(struct mako_state *state,
 		uint32_t id) {
-	struct mako_notification *notif;
-	wl_list_for_each(notif, &state->notifications, link) {
-		if (notif->id == id) {
-			return notif;
-		}
-	}
-	return NULL;
+	return hash_table_get(&state->notification_ids, &id, sizeof(id));
 }
 
 struct mako_notification *get_tagged_notification(struct mako_state *state,
 		const char *tag, const char *app_name) {
-	struct mako_notification *notif;
-	wl_list_for_each(notif, &state->notifications, link) {
-		if (notif->tag && strlen(notif->tag) != 0 &&
-				strcmp(notif->tag, tag) == 0 &&
-				strcmp(notif->app_name, app_name) == 0) {
-			return notif;
-		}
+	size_t key_len;
+	char *key = get_tag_key(app_name, tag, &key_len);
+	if (key == NULL) {
+		return NULL;
 	}
-	return NULL;
+	struct mako_notification *notif =
+		hash_table_get(&state->notification_tags, key, key_len);
+	free(key);
+	return notif;
 }
 
 void close_group_notifications(struct mako_notification *top_notif,
@@ -175,31 +517,80 @@ void close_group_notifications(struct mako_notification *top_notif,
 		bool add_to_history) {
 	struct mako_state *state = top_notif->state;
 
-	if (top_notif->style.group_criteria_spec.none) {
+	if (top_notif->group == NULL) {
 		// No grouping, just close the notification
 		close_notification(top_notif, reason, add_to_history);
 		return;
 	}
 
-	struct mako_criteria *notif_criteria = create_criteria_from_notification(
-		top_notif, &top_notif->style.group_criteria_spec);
-
-	struct mako_notification *notif, *tmp;
-	wl_list_for_each_safe(notif, tmp, &state->notifications, link) {
-		if (match_criteria(notif_criteria, notif)) {
-			close_notification(notif, reason, add_to_history);
+	struct wl_array notifs;
+	wl_array_init(&notifs);
+	struct mako_notification *notif;
+	wl_list_for_each(notif, &top_notif->group->members, group_link) {
+		struct mako_notification **notif_ptr =
+			wl_array_add(&notifs, sizeof(struct mako_notification *));
+		if (notif_ptr == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			wl_array_release(&notifs);
+			return;
 		}
+		*notif_ptr = notif;
 	}
 
-	destroy_criteria(notif_criteria);
+	close_notifications(state, &notifs, reason, add_to_history);
+	wl_array_release(&notifs);
 }
 
 void close_all_notifications(struct mako_state *state,
 		enum mako_notification_close_reason reason,
 		bool add_to_history) {
+	struct wl_array notifs;
+	wl_array_init(&notifs);
+	struct mako_notification *notif;
+	wl_list_for_each(notif, &state->notifications, link) {
+		struct mako_notification **notif_ptr =
+			wl_array_add(&notifs, sizeof(struct mako_notification *));
+		if (notif_ptr == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			wl_array_release(&notifs);
+			return;
+		}
+		*notif_ptr = notif;
+	}
+
+	close_notifications(state, &notifs, reason, add_to_history);
+	wl_array_release(&notifs);
+}
+
+void close_expired_notifications(struct mako_state *state) {
+	struct wl_array notifs;
+	wl_array_init(&notifs);
 	struct mako_notification *notif, *tmp;
-	wl_list_for_each_safe(notif, tmp, &state->notifications, link) {
-		close_notification(notif, reason, add_to_history);
+	wl_list_for_each_safe(notif, tmp, &state->expired_notifications,
+			expired_link) {
+		struct mako_notification **notif_ptr =
+			wl_array_add(&notifs, sizeof(struct mako_notification *));
+		if (notif_ptr == NULL) {
+			// Close the rest one by one
+			break;
+		}
+		*notif_ptr = notif;
+		wl_list_remove(&notif->expired_link);
+		wl_list_init(&notif->expired_link);
+	}
+
+	if (notifs.size > 0) {
+		close_notifications(state, &notifs, MAKO_NOTIFICATION_CLOSE_EXPIRED,
+			true);
+	}
+	wl_array_release(&notifs);
+
+	while (!wl_list_empty(&state->expired_notifications)) {
+		notif = wl_container_of(state->expired_notifications.next, notif,
+			expired_link);
+		struct mako_surface *surface = notif->surface;
+		close_notification(notif, MAKO_NOTIFICATION_CLOSE_EXPIRED, true);
+		set_dirty(surface);
 	}
 }
 
@@ -378,6 +769,59 @@ static void try_invoke_action(struct mako_notification *notif,
 	close_notification(notif, MAKO_NOTIFICATION_CLOSE_DISMISSED, true);
 }
 
+static const char *urgency_name(enum mako_notification_urgency urgency) {
+	switch (urgency) {
+	case MAKO_NOTIFICATION_URGENCY_LOW:
+		return "low";
+	case MAKO_NOTIFICATION_URGENCY_NORMAL:
+		return "normal";
+	case MAKO_NOTIFICATION_URGENCY_CRITICAL:
+		return "critical";
+	case MAKO_NOTIFICATION_URGENCY_UNKNOWN:
+		break;
+	}
+	return "";
+}
+
+static void execute_command(struct mako_notification *notif,
+		const char *command) {
+	// The notification is passed through the environment. The ID is also
+	// passed as $1, which is how it used to be done.
+	char *env[] = {
+		mako_asprintf("id=%" PRIu32, notif->id),
+		mako_asprintf("app_name=%s", notif->app_name),
+		mako_asprintf("app_icon=%s", notif->app_icon),
+		mako_asprintf("summary=%s", notif->summary),
+		mako_asprintf("body=%s", notif->body),
+		mako_asprintf("category=%s", notif->category),
+		mako_asprintf("desktop_entry=%s", notif->desktop_entry),
+		mako_asprintf("urgency=%s", urgency_name(notif->urgency)),
+		NULL,
+	};
+	size_t env_len = sizeof(env) / sizeof(env[0]) - 1;
+
+	bool ok = true;
+	for (size_t i = 0; i < env_len; ++i) {
+		ok = ok && env[i] != NULL;
+	}
+
+	if (ok) {
+		char id_str[32];
+		snprintf(id_str, sizeof(id_str), "%" PRIu32, notif->id);
+
+		// This doesn't wait for the command, see process.c
+		char *const argv[] = { "sh", "-c", (char *)command, "sh", id_str, NULL };
+		spawn_process(&notif->state->spawner, argv, env,
+			notif->style.exec_timeout);
+	} else {
+		fprintf(stderr, "allocation failed\n");
+	}
+
+	for (size_t i = 0; i < env_len; ++i) {
+		free(env[i]);
+	}
+}
+
 void notification_execute_binding(struct mako_notification *notif,
 		const struct mako_binding *binding,
 		const struct mako_binding_context *ctx) {
@@ -402,37 +846,7 @@ void notification_execute_binding(struct mako_notification *notif,
 		break;
 	case MAKO_BINDING_EXEC:
 		assert(binding->command != NULL);
-		pid_t pid = fork();
-		if (pid < 0) {
-			perror("fork failed");
-			break;
-		} else if (pid == 0) {
-			// Double-fork to avoid SIGCHLD issues
-			pid = fork();
-			if (pid < 0) {
-				perror("fork failed");
-				_exit(1);
-			} else if (pid == 0) {
-				// We pass variables using additional sh arguments. To convert
-				// back the arguments to variables, insert a short script
-				// preamble before the user's command.
-				const char setup_vars[] = "id=\"$1\"\n";
-
-				char *cmd = mako_asprintf("%s%s", setup_vars, binding->command);
-
-				char id_str[32];
-				snprintf(id_str, sizeof(id_str), "%" PRIu32, notif->id);
-
-				char *const argv[] = { "sh", "-c", cmd, "sh", id_str, NULL };
-				execvp("sh", argv);
-				perror("exec failed");
-				_exit(1);
-			}
-			_exit(0);
-		}
-		if (waitpid(pid, NULL, 0) < 0) {
-			perror("waitpid failed");
-		}
+		execute_command(notif, binding->command);
 		break;
 	}
 }
@@ -507,72 +921,7 @@ void insert_notification(struct mako_state *state, struct mako_notification *not
 	}
 
 	wl_list_insert(insert_node, &notif->link);
+	index_notification(notif);
 
 	emit_notifications_changed(state);
 }
-
-// Iterate through all of the current notifications and group any that share
-// the same values for all of the criteria fields in `spec`. Returns the number
-// of notifications in the resulting group, or -1 if something goes wrong
-// with criteria.
-int group_notifications(struct mako_state *state, struct mako_criteria *criteria) {
-	struct wl_list matches = {0};
-	wl_list_init(&matches);
-
-	// Now we're going to find all of the matching notifications and stick
-	// them in a different list. Removing the first one from the global list
-	// is technically unnecessary, since it will go back in the same place, but
-	// it makes the rest of this logic nicer.
-	struct wl_list *location = NULL;  // The place we're going to reinsert them.
-	struct mako_notification *notif = NULL, *tmp = NULL;
-	size_t count = 0;
-	wl_list_for_each_safe(notif, tmp, &state->notifications, link) {
-		if (!match_criteria(criteria, notif)) {
-			continue;
-		}
-
-		if (!location) {
-			location = notif->link.prev;
-		}
-
-		wl_list_remove(&notif->link);
-		wl_list_insert(matches.prev, &notif->link);
-		notif->group_index = count++;
-	}
-
-	// If count is zero, we don't need to worry about changing anything. The
-	// notification's style has its grouping criteria set to none.
-
-	if (count == 1) {
-		// If we matched a single notification, it means that it has grouping
-		// criteria set, but didn't have any others to group with. This makes
-		// it ungrouped just as if it had no grouping criteria. If this is a
-		// new notification, its index is already set to -1. However, this also
-		// happens when a notification had been part of a group and all the
-		// others have closed, so we need to set it anyway.
-		// We can't use the current pointer, wl_list_for_each_safe clobbers it.
-		notif = wl_container_of(matches.prev, notif, link);
-		notif->group_index = -1;
-	}
-
-	// Now we need to rematch criteria for all of the grouped notifications,
-	// in case it changes their styles. We also take this opportunity to record
-	// the total number of notifications in the group, so that it can be used
-	// in the notifications' format.
-	// We can't skip this even if there was only a single match, as we may be
-	// removing the second-to-last notification of a group, and still need to
-	// potentially change style now that the matched one isn't in a group
-	// anymore.
-	wl_list_for_each(notif, &matches, link) {
-		notif->group_count = count;
-	}
-
-	// Place all of the matches back into the list where the first one was
-	// originally.
-	wl_list_insert_list(location, &matches);
-
-	// We don't actually re-apply criteria here, that will happen just before
-	// we render each notification anyway.
-
-	return count;
-}
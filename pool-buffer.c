@@ -1,6 +1,7 @@
 #include <cairo/cairo.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
@@ -61,45 +62,111 @@ static const struct wl_buffer_listener buffer_listener = {
 	.release = buffer_handle_release,
 };
 
-static struct pool_buffer *create_buffer(struct wl_shm *shm,
-		struct pool_buffer *buf, int32_t width, int32_t height) {
-	const enum wl_shm_format wl_fmt = WL_SHM_FORMAT_ARGB8888;
-	const cairo_format_t cairo_fmt = CAIRO_FORMAT_ARGB32;
+// Makes sure the pool can hold at least `size` bytes. It grows by half its
+// capacity at a time, so that a growing stack of notifications doesn't need a
+// new mapping every time.
+static bool reserve_pool(struct wl_shm *shm, struct pool_buffer *buf,
+		size_t size) {
+	if (buf->pool != NULL && size <= buf->size) {
+		return true;
+	}
 
-	uint32_t stride = cairo_format_stride_for_width(cairo_fmt, width);
-	size_t size = stride * height;
+	size_t capacity = buf->size + buf->size / 2;
+	if (capacity < size) {
+		capacity = size;
+	}
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	capacity = (capacity + page_size - 1) / page_size * page_size;
+	if (capacity > INT32_MAX) {
+		return false;
+	}
 
-	void *data = NULL;
-	if (size > 0) {
-		int fd = create_shm_file(size);
+	if (buf->pool == NULL) {
+		int fd = create_shm_file(capacity);
 		if (fd == -1) {
-			return NULL;
+			return false;
 		}
 
-		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		void *data = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0);
 		if (data == MAP_FAILED) {
 			close(fd);
-			return NULL;
+			return false;
 		}
 
-		struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
-		buf->buffer =
-			wl_shm_pool_create_buffer(pool, 0, width, height, stride, wl_fmt);
-		wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
-		wl_shm_pool_destroy(pool);
-
-		close(fd);
+		buf->pool = wl_shm_create_pool(shm, fd, capacity);
+		buf->fd = fd;
+		buf->data = data;
+		buf->size = capacity;
+		return true;
 	}
 
+	// Nothing may point into the old mapping anymore
+	if (ftruncate(buf->fd, capacity) < 0) {
+		return false;
+	}
+	void *data = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+		buf->fd, 0);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	munmap(buf->data, buf->size);
+	wl_shm_pool_resize(buf->pool, capacity);
 	buf->data = data;
-	buf->size = size;
+	buf->size = capacity;
+	return true;
+}
+
+// Changes the size of a buffer which isn't busy, reusing its pool and Pango
+// context.
+static bool resize_buffer(struct wl_shm *shm, struct pool_buffer *buf,
+		int32_t width, int32_t height) {
+	const enum wl_shm_format wl_fmt = WL_SHM_FORMAT_ARGB8888;
+	const cairo_format_t cairo_fmt = CAIRO_FORMAT_ARGB32;
+
+	if (buf->buffer) {
+		wl_buffer_destroy(buf->buffer);
+		buf->buffer = NULL;
+	}
+	if (buf->cairo) {
+		cairo_destroy(buf->cairo);
+		buf->cairo = NULL;
+	}
+	if (buf->surface) {
+		cairo_surface_destroy(buf->surface);
+		buf->surface = NULL;
+	}
+	// Whatever was drawn is meaningless at the new size
+	wl_array_release(&buf->contents);
+	wl_array_init(&buf->contents);
+	buf->undefined = true;
+
+	uint32_t stride = cairo_format_stride_for_width(cairo_fmt, width);
+	size_t size = (size_t)stride * height;
+
+	void *data = NULL;
+	if (size > 0) {
+		if (!reserve_pool(shm, buf, size)) {
+			return false;
+		}
+		data = buf->data;
+
+		buf->buffer = wl_shm_pool_create_buffer(buf->pool, 0, width, height,
+			stride, wl_fmt);
+		wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
+	}
+
 	buf->width = width;
 	buf->height = height;
 	buf->surface = cairo_image_surface_create_for_data(data, cairo_fmt, width,
 		height, stride);
 	buf->cairo = cairo_create(buf->surface);
-	buf->pango = pango_cairo_create_context(buf->cairo);
-	return buf;
+	if (buf->pango == NULL) {
+		buf->pango = pango_cairo_create_context(buf->cairo);
+	} else {
+		pango_cairo_update_context(buf->cairo, buf->pango);
+	}
+	return true;
 }
 
 void finish_buffer(struct pool_buffer *buffer) {
@@ -115,9 +182,12 @@ void finish_buffer(struct pool_buffer *buffer) {
 	if (buffer->pango) {
 		g_object_unref(buffer->pango);
 	}
-	if (buffer->data) {
+	if (buffer->pool) {
+		wl_shm_pool_destroy(buffer->pool);
+		close(buffer->fd);
 		munmap(buffer->data, buffer->size);
 	}
+	wl_array_release(&buffer->contents);
 	memset(buffer, 0, sizeof(struct pool_buffer));
 }
 
@@ -134,12 +204,10 @@ struct pool_buffer *get_next_buffer(struct wl_shm *shm,
 		return NULL;
 	}
 
-	if (buffer->width != width || buffer->height != height) {
-		finish_buffer(buffer);
-	}
-
-	if (!buffer->buffer) {
-		if (!create_buffer(shm, buffer, width, height)) {
+	if (buffer->buffer == NULL || buffer->width != width ||
+			buffer->height != height) {
+		if (!resize_buffer(shm, buffer, width, height)) {
+			finish_buffer(buffer);
 			return NULL;
 		}
 	}
@@ -0,0 +1,681 @@
+#define _DEFAULT_SOURCE // for syscall()
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "event-loop.h"
+#include "process.h"
+
+extern char **environ;
+
+// How often children are polled when pidfds aren't supported
+#define REAP_INTERVAL_MS 250
+
+// Requests sent to the spawn helper are this header followed by argc + envc
+// NUL-terminated strings, in a single packet.
+struct spawn_request {
+	uint32_t argc, envc;
+	int32_t max_exec; // see mako_config
+	int32_t exec_timeout; // see spawn_process()
+};
+
+#define MAX_SPAWN_REQUEST_SIZE (64 * 1024)
+// Commands waiting for a free slot, see max-exec. Past that, the oldest ones
+// are dropped: a storm of notifications shouldn't run stale commands minutes
+// later, nor use unbounded memory.
+#define MAX_QUEUED_PROCESSES 32
+
+static void free_strv(char **strv) {
+	if (strv == NULL) {
+		return;
+	}
+	for (size_t i = 0; strv[i] != NULL; ++i) {
+		free(strv[i]);
+	}
+	free(strv);
+}
+
+static size_t strv_len(char *const strv[]) {
+	size_t len = 0;
+	while (strv != NULL && strv[len] != NULL) {
+		++len;
+	}
+	return len;
+}
+
+static char **copy_strv(char *const strv[]) {
+	size_t len = strv_len(strv);
+	char **copy = calloc(len + 1, sizeof(char *));
+	if (copy == NULL) {
+		return NULL;
+	}
+	for (size_t i = 0; i < len; ++i) {
+		copy[i] = strdup(strv[i]);
+		if (copy[i] == NULL) {
+			free_strv(copy);
+			return NULL;
+		}
+	}
+	return copy;
+}
+
+static bool env_has_name(char *const env[], const char *var) {
+	size_t name_len = strcspn(var, "=");
+	for (size_t i = 0; env != NULL && env[i] != NULL; ++i) {
+		if (strncmp(env[i], var, name_len) == 0 && env[i][name_len] == '=') {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Adds env to the current environment, replacing the variables with the same
+// names. The strings aren't copied.
+static char **merge_env(char *const env[]) {
+	size_t len = strv_len(env) + strv_len(environ);
+	char **merged = calloc(len + 1, sizeof(char *));
+	if (merged == NULL) {
+		return NULL;
+	}
+
+	size_t i = 0;
+	for (size_t j = 0; env != NULL && env[j] != NULL; ++j) {
+		merged[i++] = env[j];
+	}
+	for (size_t j = 0; environ[j] != NULL; ++j) {
+		if (!env_has_name(env, environ[j])) {
+			merged[i++] = environ[j];
+		}
+	}
+	return merged;
+}
+
+// Returns an errno value.
+static int spawn_child(pid_t *pid, char *const argv[], char *const env[]) {
+	char **envp = merge_env(env);
+	if (envp == NULL) {
+		return ENOMEM;
+	}
+
+	// mako and the helper block the signals they handle through a signalfd,
+	// don't pass that on to the child
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	sigset_t mask;
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGQUIT);
+	posix_spawnattr_setsigdefault(&attr, &mask);
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+		POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+	int err = posix_spawnp(pid, argv[0], NULL, &attr, argv, envp);
+	posix_spawnattr_destroy(&attr);
+	free(envp);
+	return err;
+}
+
+// It's the leader of its own process group, so that whatever it started is
+// terminated too.
+static void terminate_child(pid_t pid) {
+	if (kill(-pid, SIGTERM) < 0 && errno != ESRCH) {
+		fprintf(stderr, "failed to terminate process %d: %s\n",
+			(int)pid, strerror(errno));
+	}
+}
+
+void init_spawner(struct mako_spawner *spawner,
+		struct mako_event_loop *event_loop, const struct mako_config *config,
+		struct mako_spawn_helper *helper) {
+	spawner->event_loop = event_loop;
+	spawner->config = config;
+	spawner->helper = helper;
+	wl_list_init(&spawner->children);
+	spawner->children_len = 0;
+	wl_list_init(&spawner->queue);
+	spawner->reap_timer = NULL;
+}
+
+static void destroy_child(struct mako_child *child) {
+	destroy_event_source(child->source);
+	if (child->pidfd >= 0) {
+		close(child->pidfd);
+	}
+	destroy_timer(child->timer);
+	wl_list_remove(&child->link);
+	--child->spawner->children_len;
+	free(child);
+}
+
+static void destroy_queued_process(struct mako_queued_process *queued) {
+	wl_list_remove(&queued->link);
+	free_strv(queued->argv);
+	free_strv(queued->env);
+	free(queued);
+}
+
+void finish_spawner(struct mako_spawner *spawner) {
+	struct mako_child *child, *child_tmp;
+	wl_list_for_each_safe(child, child_tmp, &spawner->children, link) {
+		destroy_child(child);
+	}
+
+	struct mako_queued_process *queued, *queued_tmp;
+	wl_list_for_each_safe(queued, queued_tmp, &spawner->queue, link) {
+		destroy_queued_process(queued);
+	}
+
+	destroy_timer(spawner->reap_timer);
+	spawner->reap_timer = NULL;
+}
+
+static int open_pidfd(pid_t pid) {
+#if defined(SYS_pidfd_open)
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static bool start_process(struct mako_spawner *spawner, char *const argv[],
+	char *const env[], int32_t timeout);
+
+static bool has_free_slot(struct mako_spawner *spawner) {
+	int32_t max = spawner->config->max_exec;
+	return max <= 0 || spawner->children_len < (size_t)max;
+}
+
+static void start_queued_processes(struct mako_spawner *spawner) {
+	while (!wl_list_empty(&spawner->queue) && has_free_slot(spawner)) {
+		struct mako_queued_process *queued =
+			wl_container_of(spawner->queue.next, queued, link);
+		start_process(spawner, queued->argv, queued->env, queued->timeout);
+		destroy_queued_process(queued);
+	}
+}
+
+static int handle_child_exit(int fd, uint32_t events, void *data) {
+	struct mako_child *child = data;
+	struct mako_spawner *spawner = child->spawner;
+
+	// The pidfd is readable once the child has exited, so this won't block
+	if (waitpid(child->pid, NULL, WNOHANG) == 0) {
+		return 0;
+	}
+
+	destroy_child(child);
+	start_queued_processes(spawner);
+	return 0;
+}
+
+static void reap_children(void *data);
+
+static void schedule_reap(struct mako_spawner *spawner) {
+	if (spawner->reap_timer == NULL) {
+		spawner->reap_timer = add_event_loop_timer(spawner->event_loop,
+			REAP_INTERVAL_MS, 0, reap_children, spawner);
+	}
+}
+
+// Fallback for kernels without pidfd_open(), which waits for the children
+// without blocking every once in a while.
+static void reap_children(void *data) {
+	struct mako_spawner *spawner = data;
+	spawner->reap_timer = NULL;
+
+	bool waiting = false;
+	struct mako_child *child, *tmp;
+	wl_list_for_each_safe(child, tmp, &spawner->children, link) {
+		if (child->pidfd >= 0) {
+			continue;
+		}
+		if (waitpid(child->pid, NULL, WNOHANG) == 0) {
+			waiting = true;
+			continue;
+		}
+		destroy_child(child);
+	}
+
+	start_queued_processes(spawner);
+	if (waiting) {
+		schedule_reap(spawner);
+	}
+}
+
+static void handle_child_timeout(void *data) {
+	struct mako_child *child = data;
+	child->timer = NULL;
+
+	// It's reaped like any other child once it exits
+	terminate_child(child->pid);
+}
+
+static bool start_process(struct mako_spawner *spawner, char *const argv[],
+		char *const env[], int32_t timeout) {
+	// Allocate first, a child which can't be tracked would never be reaped
+	struct mako_child *child = calloc(1, sizeof(struct mako_child));
+	if (child == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
+	child->spawner = spawner;
+	child->pidfd = -1;
+
+	int err = spawn_child(&child->pid, argv, env);
+	if (err != 0) {
+		fprintf(stderr, "failed to spawn %s: %s\n", argv[0], strerror(err));
+		free(child);
+		return false;
+	}
+
+	wl_list_insert(spawner->children.prev, &child->link);
+	++spawner->children_len;
+
+	child->pidfd = open_pidfd(child->pid);
+	if (child->pidfd >= 0) {
+		child->source = add_event_loop_fd(spawner->event_loop, child->pidfd,
+			EPOLLIN, handle_child_exit, child);
+		if (child->source == NULL) {
+			close(child->pidfd);
+			child->pidfd = -1;
+		}
+	}
+	if (child->pidfd < 0) {
+		schedule_reap(spawner);
+	}
+
+	if (timeout > 0) {
+		child->timer = add_event_loop_timer(spawner->event_loop, timeout, 0,
+			handle_child_timeout, child);
+	}
+
+	return true;
+}
+
+// Returns false if the process should be spawned by mako instead.
+static bool send_spawn_request(struct mako_spawner *spawner,
+		char *const argv[], char *const env[], int32_t timeout) {
+	struct mako_spawn_helper *helper = spawner->helper;
+	struct spawn_request req = {
+		.argc = strv_len(argv),
+		.envc = strv_len(env),
+		.max_exec = spawner->config->max_exec,
+		.exec_timeout = timeout,
+	};
+
+	size_t size = sizeof(req);
+	for (size_t i = 0; i < req.argc; ++i) {
+		size += strlen(argv[i]) + 1;
+	}
+	for (size_t i = 0; i < req.envc; ++i) {
+		size += strlen(env[i]) + 1;
+	}
+	if (size > MAX_SPAWN_REQUEST_SIZE) {
+		return false;
+	}
+
+	char *buf = malloc(size);
+	if (buf == NULL) {
+		return false;
+	}
+	memcpy(buf, &req, sizeof(req));
+	char *p = buf + sizeof(req);
+	for (size_t i = 0; i < req.argc; ++i) {
+		p = stpcpy(p, argv[i]) + 1;
+	}
+	for (size_t i = 0; i < req.envc; ++i) {
+		p = stpcpy(p, env[i]) + 1;
+	}
+
+	ssize_t n = send(helper->fd, buf, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+	free(buf);
+	if (n < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			fprintf(stderr, "spawn helper failed, spawning from mako: %s\n",
+				strerror(errno));
+			stop_spawn_helper(helper);
+		}
+		return false;
+	}
+	return true;
+}
+
+bool spawn_process(struct mako_spawner *spawner, char *const argv[],
+		char *const env[], int32_t timeout) {
+	if (spawner->config->exec_helper && spawner->helper->pid != 0 &&
+			send_spawn_request(spawner, argv, env, timeout)) {
+		return true;
+	}
+
+	if (has_free_slot(spawner)) {
+		return start_process(spawner, argv, env, timeout);
+	}
+
+	struct mako_queued_process *queued =
+		calloc(1, sizeof(struct mako_queued_process));
+	if (queued == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
+	queued->argv = copy_strv(argv);
+	queued->env = copy_strv(env);
+	queued->timeout = timeout;
+	if (queued->argv == NULL || queued->env == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		free_strv(queued->argv);
+		free_strv(queued->env);
+		free(queued);
+		return false;
+	}
+	if (wl_list_length(&spawner->queue) >= MAX_QUEUED_PROCESSES) {
+		fprintf(stderr, "Too many exec commands waiting, dropping the oldest\n");
+		struct mako_queued_process *oldest =
+			wl_container_of(spawner->queue.next, oldest, link);
+		destroy_queued_process(oldest);
+	}
+	wl_list_insert(spawner->queue.prev, &queued->link);
+	return true;
+}
+
+// What follows only runs in the helper, which has its own small loop instead
+// of mako's event loop.
+
+struct helper_child {
+	pid_t pid;
+	bool has_deadline;
+	struct timespec deadline; // CLOCK_MONOTONIC
+};
+
+struct helper_request {
+	struct wl_list link;
+	size_t size;
+	char data[];
+};
+
+struct spawn_helper {
+	int fd;
+	struct wl_array children; // struct helper_child
+	struct wl_list queue; // helper_request::link
+	int32_t max_exec; // From the last request
+};
+
+// Points argv and env into data, which must outlive them.
+static bool parse_spawn_request(char *data, size_t size,
+		struct spawn_request *req, char ***argv_ptr, char ***env_ptr) {
+	if (size < sizeof(*req)) {
+		return false;
+	}
+	memcpy(req, data, sizeof(*req));
+	if (req->argc == 0 || req->argc > size || req->envc > size) {
+		return false;
+	}
+
+	char **argv = calloc(req->argc + 1, sizeof(char *));
+	char **env = calloc(req->envc + 1, sizeof(char *));
+	if (argv == NULL || env == NULL) {
+		goto error;
+	}
+
+	char *p = data + sizeof(*req), *end = data + size;
+	for (size_t i = 0; i < req->argc + req->envc; ++i) {
+		char *nul = memchr(p, '\0', end - p);
+		if (nul == NULL) {
+			goto error;
+		}
+		if (i < req->argc) {
+			argv[i] = p;
+		} else {
+			env[i - req->argc] = p;
+		}
+		p = nul + 1;
+	}
+
+	*argv_ptr = argv;
+	*env_ptr = env;
+	return true;
+
+error:
+	free(argv);
+	free(env);
+	return false;
+}
+
+static size_t helper_children_len(struct spawn_helper *helper) {
+	return helper->children.size / sizeof(struct helper_child);
+}
+
+static void helper_start_request(struct spawn_helper *helper,
+		struct helper_request *request) {
+	struct spawn_request req;
+	char **argv, **env;
+	if (!parse_spawn_request(request->data, request->size, &req,
+			&argv, &env)) {
+		fprintf(stderr, "spawn helper: invalid request\n");
+		return;
+	}
+
+	struct helper_child *child =
+		wl_array_add(&helper->children, sizeof(struct helper_child));
+	if (child == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		goto out;
+	}
+
+	int err = spawn_child(&child->pid, argv, env);
+	if (err != 0) {
+		fprintf(stderr, "failed to spawn %s: %s\n", argv[0], strerror(err));
+		helper->children.size -= sizeof(struct helper_child);
+		goto out;
+	}
+
+	child->has_deadline = req.exec_timeout > 0;
+	if (child->has_deadline) {
+		clock_gettime(CLOCK_MONOTONIC, &child->deadline);
+		child->deadline.tv_sec += req.exec_timeout / 1000;
+		child->deadline.tv_nsec += (long)(req.exec_timeout % 1000) * 1000000;
+		if (child->deadline.tv_nsec >= 1000000000) {
+			child->deadline.tv_nsec -= 1000000000;
+			++child->deadline.tv_sec;
+		}
+	}
+
+out:
+	free(argv);
+	free(env);
+}
+
+static void helper_start_queued(struct spawn_helper *helper) {
+	while (!wl_list_empty(&helper->queue) && (helper->max_exec <= 0 ||
+			helper_children_len(helper) < (size_t)helper->max_exec)) {
+		struct helper_request *request =
+			wl_container_of(helper->queue.next, request, link);
+		wl_list_remove(&request->link);
+		helper_start_request(helper, request);
+		free(request);
+	}
+}
+
+// Returns false once mako has gone away.
+static bool helper_receive(struct spawn_helper *helper) {
+	static char buf[MAX_SPAWN_REQUEST_SIZE];
+	ssize_t n = recv(helper->fd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (n < 0) {
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	} else if (n == 0) {
+		return false;
+	}
+
+	struct spawn_request req;
+	if ((size_t)n >= sizeof(req)) {
+		memcpy(&req, buf, sizeof(req));
+		helper->max_exec = req.max_exec;
+	}
+
+	struct helper_request *request =
+		malloc(sizeof(struct helper_request) + n);
+	if (request == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return true;
+	}
+	request->size = n;
+	memcpy(request->data, buf, n);
+	if (wl_list_length(&helper->queue) >= MAX_QUEUED_PROCESSES) {
+		fprintf(stderr, "Too many exec commands waiting, dropping the oldest\n");
+		struct helper_request *oldest =
+			wl_container_of(helper->queue.next, oldest, link);
+		wl_list_remove(&oldest->link);
+		free(oldest);
+	}
+	wl_list_insert(helper->queue.prev, &request->link);
+	return true;
+}
+
+static void helper_reap(struct spawn_helper *helper) {
+	pid_t pid;
+	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+		struct helper_child *children = helper->children.data;
+		size_t len = helper_children_len(helper);
+		for (size_t i = 0; i < len; ++i) {
+			if (children[i].pid == pid) {
+				children[i] = children[len - 1];
+				helper->children.size -= sizeof(struct helper_child);
+				break;
+			}
+		}
+	}
+}
+
+// Terminates the children which ran out of time, and returns the number of
+// milliseconds until the next deadline, or -1.
+static int helper_check_deadlines(struct spawn_helper *helper) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	int64_t next_ms = -1;
+	struct helper_child *child;
+	wl_array_for_each(child, &helper->children) {
+		if (!child->has_deadline) {
+			continue;
+		}
+		int64_t ms = (int64_t)(child->deadline.tv_sec - now.tv_sec) * 1000 +
+			(child->deadline.tv_nsec - now.tv_nsec + 999999) / 1000000;
+		if (ms <= 0) {
+			terminate_child(child->pid);
+			child->has_deadline = false;
+		} else if (next_ms < 0 || ms < next_ms) {
+			next_ms = ms;
+		}
+	}
+	return next_ms > INT32_MAX ? INT32_MAX : (int)next_ms;
+}
+
+static void run_spawn_helper(int fd) {
+	// Only exit once mako closes the socket, and learn about exited children
+	// through a signalfd
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGQUIT);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	int sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sfd < 0) {
+		fprintf(stderr, "spawn helper: signalfd: %s\n", strerror(errno));
+		return;
+	}
+
+	struct spawn_helper helper = { .fd = fd };
+	wl_array_init(&helper.children);
+	wl_list_init(&helper.queue);
+
+	while (true) {
+		int timeout = helper_check_deadlines(&helper);
+		struct pollfd fds[] = {
+			{ .fd = fd, .events = POLLIN },
+			{ .fd = sfd, .events = POLLIN },
+		};
+		if (poll(fds, 2, timeout) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "spawn helper: poll: %s\n", strerror(errno));
+			break;
+		}
+
+		if (fds[1].revents & POLLIN) {
+			struct signalfd_siginfo info;
+			while (read(sfd, &info, sizeof(info)) > 0) {
+				// Drain
+			}
+			helper_reap(&helper);
+		}
+
+		if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) &&
+				!helper_receive(&helper)) {
+			break;
+		}
+
+		helper_start_queued(&helper);
+	}
+
+	// The queued requests are dropped, the children keep running
+	close(sfd);
+}
+
+bool start_spawn_helper(struct mako_spawn_helper *helper) {
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+		fprintf(stderr, "socketpair: %s\n", strerror(errno));
+		return false;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "fork: %s\n", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	} else if (pid == 0) {
+		close(fds[0]);
+		run_spawn_helper(fds[1]);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	helper->pid = pid;
+	helper->fd = fds[0];
+	return true;
+}
+
+void stop_spawn_helper(struct mako_spawn_helper *helper) {
+	if (helper->pid == 0) {
+		return;
+	}
+
+	// It exits once it sees the socket is closed
+	close(helper->fd);
+	helper->fd = -1;
+	if (waitpid(helper->pid, NULL, 0) < 0) {
+		fprintf(stderr, "waitpid: %s\n", strerror(errno));
+	}
+	helper->pid = 0;
+}
@@ -1,9 +1,11 @@
 #include <stdlib.h>
+#include <string.h>
 #include <cairo/cairo.h>
 #include <pango/pangocairo.h>
 
 #include "config.h"
 #include "criteria.h"
+#include "hash-table.h"
 #include "mako.h"
 #include "notification.h"
 #include "render.h"
@@ -13,6 +15,9 @@
 
 #define M_PI 3.14159265358979323846
 
+// Used to tell apart the contents of different tiles, see mako_frame_rect.
+static uint32_t tile_serial = 0;
+
 // HiDPI conventions: local variables are in surface-local coordinates, unless
 // they have a "buffer_" prefix, in which case they are in buffer-local
 // coordinates.
@@ -96,9 +101,12 @@ static void set_font_options(cairo_t *cairo, struct mako_surface *surface) {
 	cairo_font_options_destroy(fo);
 }
 
-static int render_notification(cairo_t *cairo, struct mako_state *state, struct mako_surface *surface,
-		struct mako_style *style, const char *text, struct mako_icon *icon, int offset_y, int scale,
-		struct mako_hotspot *hotspot, int progress) {
+// Lay out and draw a notification into a new tile of the given width.
+// `buffer_cairo` is only used to create the text layout.
+static struct mako_tile *create_tile(cairo_t *buffer_cairo,
+		struct mako_surface *surface, struct mako_style *style,
+		const char *text, struct mako_icon *icon, int notif_width, int scale,
+		int progress) {
 	int border_size = 2 * style->border_size;
 	int padding_height = style->padding.top + style->padding.bottom;
 	int padding_width = style->padding.left + style->padding.right;
@@ -110,20 +118,6 @@ static int render_notification(cairo_t *cairo, struct mako_state *state, struct
 	bool icon_vertical = style->icon_location == MAKO_ICON_LOCATION_TOP ||
 		style->icon_location == MAKO_ICON_LOCATION_BOTTOM;
 
-	// If the compositor has forced us to shrink down, do so.
-	int notif_width =
-		(style->width <= surface->width) ? style->width : surface->width;
-
-	// offset_x is for the entire draw operation inside the surface
-	int offset_x;
-	if (surface->anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT) {
-		offset_x = surface->width - notif_width - style->margin.right;
-	} else if (surface->anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT) {
-		offset_x = style->margin.left;
-	} else { // CENTER has nothing to & with, so it's the else case
-		offset_x = (surface->width - notif_width) / 2;
-	}
-
 	// text_x is the offset of the text inside our draw operation
 	double text_x = style->padding.left;
 	if (icon != NULL && style->icon_location == MAKO_ICON_LOCATION_LEFT) {
@@ -149,9 +143,9 @@ static int render_notification(cairo_t *cairo, struct mako_state *state, struct
 			(style->padding.top * 2) : (style->padding.bottom * 2);
 	}
 
-	set_font_options(cairo, surface);
+	set_font_options(buffer_cairo, surface);
 
-	PangoLayout *layout = pango_cairo_create_layout(cairo);
+	PangoLayout *layout = pango_cairo_create_layout(buffer_cairo);
 	set_layout_size(layout, text_layout_width, text_layout_height, scale);
 	pango_layout_set_alignment(layout, style->text_alignment);
 	pango_layout_set_wrap(layout, PANGO_WRAP_WORD_CHAR);
@@ -212,14 +206,29 @@ static int render_notification(cairo_t *cairo, struct mako_state *state, struct
 		notif_height = radius_top_right + radius_bottom_right + border_size;
 	}
 
+	struct mako_tile *tile = calloc(1, sizeof(struct mako_tile));
+	if (tile == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		g_object_unref(layout);
+		return NULL;
+	}
+	tile->serial = ++tile_serial;
+	tile->width = notif_width;
+	tile->height = notif_height;
+	tile->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+		notif_width * scale, notif_height * scale);
+
+	cairo_t *cairo = cairo_create(tile->surface);
+	set_font_options(cairo, surface);
+
 	int notif_background_width = notif_width - style->border_size;
 
 	// Define the shape of the notification. The stroke is drawn centered on
 	// the edge of the fill, so we need to inset the shape by half the
 	// border_size.
 	set_rounded_rectangle(cairo,
-		offset_x + style->border_size / 2.0,
-		offset_y + style->border_size / 2.0,
+		style->border_size / 2.0,
+		style->border_size / 2.0,
 		notif_background_width,
 		notif_height - style->border_size,
 		scale, radius_top_left, radius_top_right, radius_bottom_right, radius_bottom_left);
@@ -249,8 +258,8 @@ static int render_notification(cairo_t *cairo, struct mako_state *state, struct
 	cairo_set_operator(cairo, style->colors.progress.operator);
 	set_source_u32(cairo, style->colors.progress.value);
 	set_rounded_rectangle(cairo,
-			offset_x + style->border_size,
-			offset_y + style->border_size,
+			style->border_size,
+			style->border_size,
 			progress_width,
 			notif_height - style->border_size,
 			scale, 0, 0, 0, 0);
@@ -275,30 +284,28 @@ static int render_notification(cairo_t *cairo, struct mako_state *state, struct
 		// Render icon
 		double xpos = -1;
 		double ypos = -1;
-		double ypos_center = offset_y + style->border_size +
+		double ypos_center = style->border_size +
 			(notif_height - icon->height - border_size) / 2;
-		double xpos_center = offset_x + style->border_size +
+		double xpos_center = style->border_size +
 			(notif_width - icon->width - border_size) / 2;
 
 		switch (style->icon_location) {
 		case MAKO_ICON_LOCATION_LEFT:
-			xpos = offset_x + style->border_size +
-				style->padding.left;
+			xpos = style->border_size + style->padding.left;
 			ypos = ypos_center;
 			break;
 		case MAKO_ICON_LOCATION_RIGHT:
-			xpos = offset_x + notif_width - style->border_size -
+			xpos = notif_width - style->border_size -
 				style->padding.right - icon->width;
 			ypos = ypos_center;
 			break;
 		case MAKO_ICON_LOCATION_TOP:
 			xpos = xpos_center;
-			ypos = offset_y + style->border_size +
-				style->padding.top;
+			ypos = style->border_size + style->padding.top;
 			break;
 		case MAKO_ICON_LOCATION_BOTTOM:
 			xpos = xpos_center;
-			ypos = offset_y + notif_height - style->border_size -
+			ypos = notif_height - style->border_size -
 				style->padding.bottom - icon->height;
 			break;
 		}
@@ -318,23 +325,251 @@ static int render_notification(cairo_t *cairo, struct mako_state *state, struct
 	// Render text
 	set_source_u32(cairo, style->colors.text);
 	move_to(cairo,
-		offset_x + style->border_size + text_x,
-		offset_y + style->border_size + text_y,
+		style->border_size + text_x,
+		style->border_size + text_y,
 		scale);
 	pango_cairo_update_layout(cairo, layout);
 	pango_cairo_show_layout(cairo, layout);
 
+	cairo_destroy(cairo);
+	g_object_unref(layout);
+
+	return tile;
+}
+
+void destroy_tile(struct mako_tile *tile) {
+	if (tile == NULL) {
+		return;
+	}
+	cairo_surface_destroy(tile->surface);
+	free(tile->text);
+	free(tile);
+}
+
+// Hashes every style property that affects how a notification is drawn, as
+// opposed to where it is placed.
+static uint64_t hash_style(const struct mako_style *style) {
+	struct {
+		int32_t width, height, border_size, icon_border_radius;
+		struct mako_directional padding, border_radius;
+		uint32_t background, text, border;
+		struct mako_color progress;
+		PangoAlignment text_alignment;
+		enum mako_icon_location icon_location;
+	} props;
+	// Make sure the padding bytes are deterministic.
+	memset(&props, 0, sizeof(props));
+
+	props.width = style->width;
+	props.height = style->height;
+	props.border_size = style->border_size;
+	props.icon_border_radius = style->icon_border_radius;
+	props.padding = style->padding;
+	props.border_radius = style->border_radius;
+	props.background = style->colors.background;
+	props.text = style->colors.text;
+	props.border = style->colors.border;
+	props.progress = style->colors.progress;
+	props.text_alignment = style->text_alignment;
+	props.icon_location = style->icon_location;
+
+	uint64_t hash = hash_bytes(&props, sizeof(props));
+	return hash_bytes_update(hash, style->font, strlen(style->font));
+}
+
+static int get_subpixel(struct mako_surface *surface) {
+	if (surface->surface_output == NULL) {
+		return -1;
+	}
+	return surface->surface_output->subpixel;
+}
+
+// Places a notification at the given offset in the frame, re-using the cached
+// tile in `*tile_ptr` if nothing it depends on changed. Nothing is drawn until
+// paint_frame is called. Returns the height of the notification.
+static int render_notification(cairo_t *cairo, struct mako_state *state, struct mako_surface *surface,
+		struct mako_style *style, const char *text, struct mako_icon *icon, int offset_y, int scale,
+		struct mako_hotspot *hotspot, int progress, struct mako_tile **tile_ptr,
+		struct wl_array *frame, struct wl_array *frame_tiles) {
+	// If the compositor has forced us to shrink down, do so.
+	int notif_width =
+		(style->width <= surface->width) ? style->width : surface->width;
+
+	// offset_x is for the entire draw operation inside the surface
+	int offset_x;
+	if (surface->anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT) {
+		offset_x = surface->width - notif_width - style->margin.right;
+	} else if (surface->anchor & ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT) {
+		offset_x = style->margin.left;
+	} else { // CENTER has nothing to & with, so it's the else case
+		offset_x = (surface->width - notif_width) / 2;
+	}
+
+	uint64_t style_hash = hash_style(style);
+	int subpixel = get_subpixel(surface);
+
+	struct mako_tile *tile = *tile_ptr;
+	if (tile != NULL && tile->width == notif_width && tile->scale == scale &&
+			tile->progress == progress && tile->subpixel == subpixel &&
+			tile->icon == icon && tile->style_hash == style_hash &&
+			strcmp(tile->text, text) == 0) {
+		++state->stats.tile_hits;
+	} else {
+		++state->stats.tile_misses;
+		destroy_tile(tile);
+		*tile_ptr = NULL;
+
+		tile = create_tile(cairo, surface, style, text, icon, notif_width,
+			scale, progress);
+		if (tile == NULL) {
+			return 0;
+		}
+		tile->text = strdup(text);
+		tile->style_hash = style_hash;
+		tile->icon = icon;
+		tile->scale = scale;
+		tile->progress = progress;
+		tile->subpixel = subpixel;
+		*tile_ptr = tile;
+	}
+
+	struct mako_frame_rect *rect = wl_array_add(frame, sizeof(*rect));
+	if (rect == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return 0;
+	}
+	struct mako_tile **frame_tile =
+		wl_array_add(frame_tiles, sizeof(*frame_tile));
+	if (frame_tile == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		frame->size -= sizeof(*rect);
+		return 0;
+	}
+
+	rect->x = offset_x * scale;
+	rect->y = offset_y * scale;
+	rect->width = tile->width * scale;
+	rect->height = tile->height * scale;
+	rect->tile_serial = tile->serial;
+	*frame_tile = tile;
+
 	// Update hotspot with calculated location
 	if (hotspot != NULL) {
 		hotspot->x = offset_x;
 		hotspot->y = offset_y;
-		hotspot->width = notif_width;
-		hotspot->height = notif_height;
+		hotspot->width = tile->width;
+		hotspot->height = tile->height;
 	}
 
-	g_object_unref(layout);
+	return tile->height;
+}
+
+static bool frame_rect_equal(const struct mako_frame_rect *a,
+		const struct mako_frame_rect *b) {
+	return a->x == b->x && a->y == b->y &&
+		a->width == b->width && a->height == b->height &&
+		a->tile_serial == b->tile_serial;
+}
+
+static bool frame_contains(const struct wl_array *frame,
+		const struct mako_frame_rect *rect) {
+	const struct mako_frame_rect *other;
+	wl_array_for_each(other, frame) {
+		if (frame_rect_equal(other, rect)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void add_frame_difference(cairo_region_t *region,
+		const struct wl_array *frame, const struct wl_array *other) {
+	const struct mako_frame_rect *rect;
+	wl_array_for_each(rect, frame) {
+		if (frame_contains(other, rect)) {
+			continue;
+		}
+		cairo_rectangle_int_t box = {
+			.x = rect->x,
+			.y = rect->y,
+			.width = rect->width,
+			.height = rect->height,
+		};
+		cairo_region_union_rectangle(region, &box);
+	}
+}
 
-	return notif_height;
+// Returns the region which differs between two frames, in buffer-local
+// coordinates. That is the area covered by every tile which isn't at the
+// same place in both frames.
+cairo_region_t *get_frame_damage(const struct wl_array *old_frame,
+		const struct wl_array *new_frame) {
+	cairo_region_t *region = cairo_region_create();
+	add_frame_difference(region, old_frame, new_frame);
+	add_frame_difference(region, new_frame, old_frame);
+	return region;
+}
+
+// Brings the buffer up to date with the new frame. Only the parts which
+// differ from what was last drawn into this particular buffer are repainted,
+// unless its memory was reused at a different size.
+static void paint_frame(struct pool_buffer *buffer, struct wl_array *frame,
+		struct wl_array *frame_tiles) {
+	cairo_t *cairo = buffer->cairo;
+
+	cairo_region_t *repaint;
+	if (buffer->undefined) {
+		cairo_rectangle_int_t all = {
+			.width = buffer->width,
+			.height = buffer->height,
+		};
+		repaint = cairo_region_create_rectangle(&all);
+		buffer->undefined = false;
+	} else {
+		repaint = get_frame_damage(&buffer->contents, frame);
+	}
+	int rects_len = cairo_region_num_rectangles(repaint);
+	if (rects_len > 0) {
+		cairo_save(cairo);
+		for (int i = 0; i < rects_len; ++i) {
+			cairo_rectangle_int_t box;
+			cairo_region_get_rectangle(repaint, i, &box);
+			cairo_rectangle(cairo, box.x, box.y, box.width, box.height);
+		}
+		cairo_clip(cairo);
+
+		// Clear
+		cairo_set_source_rgba(cairo, 0, 0, 0, 0);
+		cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+		cairo_paint(cairo);
+		cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
+
+		struct mako_frame_rect *rects = frame->data;
+		struct mako_tile **tiles = frame_tiles->data;
+		size_t len = frame->size / sizeof(struct mako_frame_rect);
+		for (size_t i = 0; i < len; ++i) {
+			cairo_rectangle_int_t box = {
+				.x = rects[i].x,
+				.y = rects[i].y,
+				.width = rects[i].width,
+				.height = rects[i].height,
+			};
+			if (cairo_region_contains_rectangle(repaint, &box) ==
+					CAIRO_REGION_OVERLAP_OUT) {
+				continue;
+			}
+
+			cairo_set_source_surface(cairo, tiles[i]->surface, box.x, box.y);
+			cairo_rectangle(cairo, box.x, box.y, box.width, box.height);
+			cairo_fill(cairo);
+		}
+		cairo_restore(cairo);
+	}
+	cairo_region_destroy(repaint);
+
+	wl_array_release(&buffer->contents);
+	buffer->contents = *frame;
+	wl_array_init(frame);
 }
 
 void render(struct mako_surface *surface, struct pool_buffer *buffer, int scale,
@@ -348,12 +583,10 @@ void render(struct mako_surface *surface, struct pool_buffer *buffer, int scale,
 		return;
 	}
 
-	// Clear
-	cairo_save(cairo);
-	cairo_set_source_rgba(cairo, 0, 0, 0, 0);
-	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
-	cairo_paint(cairo);
-	cairo_restore(cairo);
+	struct wl_array frame; // struct mako_frame_rect
+	wl_array_init(&frame);
+	struct wl_array frame_tiles; // struct mako_tile *, parallel to frame
+	wl_array_init(&frame_tiles);
 
 	size_t visible_count = 0;
 	size_t hidden_count = 0;
@@ -363,15 +596,16 @@ void render(struct mako_surface *surface, struct pool_buffer *buffer, int scale,
 	struct mako_notification *notif;
 	size_t total_notifications = 0;
 	wl_list_for_each(notif, &state->notifications, link) {
-		if (notif->surface != surface) {
+		if (notif->surface != surface || notification_is_pending(notif)) {
 			continue;
 		}
 		++total_notifications;
 
-		// Immediately before rendering we need to re-match all of the criteria
-		// so that matches against the anchor and output work even if the
-		// output was automatically assigned by the compositor.
-		int rematch_count = apply_each_criteria(&state->config.criteria, notif);
+		// Immediately before rendering we need to make sure the criteria are
+		// matched against the current state, so that matches against the
+		// anchor and output work even if the output was automatically
+		// assigned by the compositor. This is a no-op if nothing changed.
+		int rematch_count = resolve_notification_style(notif);
 		if (rematch_count == -1) {
 			// We encountered an allocation failure or similar while applying
 			// criteria. The notification may be partially matched, but the
@@ -418,7 +652,8 @@ void render(struct mako_surface *surface, struct pool_buffer *buffer, int scale,
 		struct mako_icon *icon = (style->icons) ? notif->icon : NULL;
 		int notif_height = render_notification(
 			cairo, state, surface, style, text, icon, total_height, scale,
-			&notif->hotspot, notif->progress);
+			&notif->hotspot, notif->progress, &notif->tile,
+			&frame, &frame_tiles);
 		free(text);
 
 		int notif_width =
@@ -440,10 +675,18 @@ void render(struct mako_surface *surface, struct pool_buffer *buffer, int scale,
 	}
 
 	if (hidden_count > 0) {
-		struct mako_notification *hidden_notif = create_notification(state);
+		if (surface->hidden_notification == NULL) {
+			surface->hidden_notification = create_notification(state);
+			if (surface->hidden_notification == NULL) {
+				wl_array_release(&frame);
+				wl_array_release(&frame_tiles);
+				return;
+			}
+			surface->hidden_notification->hidden = true;
+		}
+		struct mako_notification *hidden_notif = surface->hidden_notification;
 		hidden_notif->surface = surface;
-		hidden_notif->hidden = true;
-		apply_each_criteria(&state->config.criteria, hidden_notif);
+		resolve_notification_style(hidden_notif);
 
 		struct mako_style *style = &hidden_notif->style;
 
@@ -464,21 +707,27 @@ void render(struct mako_surface *surface, struct pool_buffer *buffer, int scale,
 			char *text = malloc(text_ln + 1);
 			if (text == NULL) {
 				fprintf(stderr, "allocation failed");
+				wl_array_release(&frame);
+				wl_array_release(&frame_tiles);
 				return;
 			}
 
 			format_text(style->format, text, format_hidden_text, &data);
 
 			int hidden_height = render_notification(
-				cairo, state, surface, style, text, NULL, total_height, scale, NULL, 0);
+				cairo, state, surface, style, text, NULL, total_height, scale, NULL, 0,
+				&hidden_notif->tile, &frame, &frame_tiles);
 			free(text);
 
 			total_height += hidden_height;
 			pending_bottom_margin = style->margin.bottom;
 		}
-		destroy_notification(hidden_notif);
 	}
 
+	paint_frame(buffer, &frame, &frame_tiles);
+	wl_array_release(&frame);
+	wl_array_release(&frame_tiles);
+
 	*rendered_width = max_width;
 	*rendered_height = total_height;
 }
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 
 #include "mako.h"
+#include "notification.h"
 #include "surface.h"
 
 void destroy_surface(struct mako_surface *surface) {
@@ -16,6 +17,10 @@ void destroy_surface(struct mako_surface *surface) {
 	}
 	finish_buffer(&surface->buffers[0]);
 	finish_buffer(&surface->buffers[1]);
+	wl_array_release(&surface->committed);
+	if (surface->hidden_notification != NULL) {
+		destroy_notification(surface->hidden_notification);
+	}
 
 	/* Clean up memory resources */
 	free(surface->configured_output);
@@ -51,6 +51,46 @@ bool parse_int_ge(const char *string, int *out, int min) {
 	}
 }
 
+// Parses a size in bytes, with an optional K, M or G suffix (powers of 1024).
+bool parse_size(const char *string, size_t *out) {
+	errno = 0;
+	char *end;
+	unsigned long long parsed = strtoull(string, &end, 10);
+	if (errno != 0 || end == string || string[0] == '-') {
+		return false;
+	}
+
+	unsigned long long multiplier = 1;
+	switch (end[0]) {
+	case '\0':
+		break;
+	case 'k':
+	case 'K':
+		multiplier = 1024ULL;
+		++end;
+		break;
+	case 'm':
+	case 'M':
+		multiplier = 1024ULL * 1024;
+		++end;
+		break;
+	case 'g':
+	case 'G':
+		multiplier = 1024ULL * 1024 * 1024;
+		++end;
+		break;
+	default:
+		return false;
+	}
+
+	if (end[0] != '\0' || parsed > SIZE_MAX / multiplier) {
+		return false;
+	}
+
+	*out = parsed * multiplier;
+	return true;
+}
+
 bool parse_color(const char *string, uint32_t *out) {
 	if (string[0] != '#') {
 		return false;
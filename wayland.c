@@ -34,6 +34,7 @@ static void output_handle_name(void *data, struct wl_output *wl_output,
 		const char *name) {
 	struct mako_output *output = data;
 	output->name = strdup(name);
+	++output->state->outputs_serial;
 }
 
 static const struct wl_output_listener output_listener = {
@@ -85,6 +86,7 @@ static void destroy_output(struct mako_output *output) {
 			surface->layer_surface_output = NULL;
 		}
 	}
+	++output->state->outputs_serial;
 	wl_list_remove(&output->link);
 	wl_output_destroy(output->wl_output);
 	free(output->name);
@@ -341,6 +343,7 @@ static void surface_handle_enter(void *data, struct wl_surface *surface,
 	// Don't bother keeping a list of outputs, a layer surface can only be on
 	// one output a a time
 	msurface->surface_output = wl_output_get_user_data(wl_output);
+	++msurface->state->outputs_serial;
 	set_dirty(msurface);
 }
 
@@ -348,6 +351,7 @@ static void surface_handle_leave(void *data, struct wl_surface *surface,
 		struct wl_output *wl_output) {
 	struct mako_surface *msurface = data;
 	msurface->surface_output = NULL;
+	++msurface->state->outputs_serial;
 }
 
 static const struct wl_surface_listener surface_listener = {
@@ -586,6 +590,34 @@ static struct mako_output *get_configured_output(struct mako_surface *surface) {
 
 static void schedule_frame_and_commit(struct mako_surface *surface);
 
+// Damage what changed since the last commit, or everything on a resize.
+static void damage_surface(struct mako_surface *surface,
+		struct pool_buffer *buffer) {
+	if (surface->committed_width != buffer->width ||
+			surface->committed_height != buffer->height) {
+		wl_surface_damage_buffer(surface->surface, 0, 0, INT32_MAX, INT32_MAX);
+	} else {
+		cairo_region_t *damage =
+			get_frame_damage(&surface->committed, &buffer->contents);
+		int rects_len = cairo_region_num_rectangles(damage);
+		for (int i = 0; i < rects_len; ++i) {
+			cairo_rectangle_int_t box;
+			cairo_region_get_rectangle(damage, i, &box);
+			wl_surface_damage_buffer(surface->surface,
+				box.x, box.y, box.width, box.height);
+		}
+		cairo_region_destroy(damage);
+	}
+
+	if (wl_array_copy(&surface->committed, &buffer->contents) < 0) {
+		// Damage everything next time
+		surface->committed_width = surface->committed_height = 0;
+		return;
+	}
+	surface->committed_width = buffer->width;
+	surface->committed_height = buffer->height;
+}
+
 // Draw and commit a new frame.
 static void send_frame(struct mako_surface *surface) {
 	struct mako_state *state = surface->state;
@@ -627,8 +659,10 @@ static void send_frame(struct mako_surface *surface) {
 			wl_surface_destroy(surface->surface);
 			surface->surface = NULL;
 		}
+		surface->committed_width = surface->committed_height = 0;
 		surface->width = surface->height = 0;
 		surface->surface_output = NULL;
+		++state->outputs_serial;
 		surface->configured = false;
 	}
 
@@ -707,7 +741,7 @@ static void send_frame(struct mako_surface *surface) {
 	wl_region_destroy(input_region);
 
 	wl_surface_set_buffer_scale(surface->surface, scale);
-	wl_surface_damage_buffer(surface->surface, 0, 0, INT32_MAX, INT32_MAX);
+	damage_surface(surface, surface->current_buffer);
 	wl_surface_attach(surface->surface, surface->current_buffer->buffer, 0, 0);
 	surface->current_buffer->busy = true;
 
@@ -751,7 +785,8 @@ static void schedule_frame_and_commit(struct mako_surface *surface) {
 }
 
 void set_dirty(struct mako_surface *surface) {
-	if (surface->dirty) {
+	// Notifications which haven't been ingested yet have no surface
+	if (surface == NULL || surface->dirty) {
 		return;
 	}
 	surface->dirty = true;